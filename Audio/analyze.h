@@ -0,0 +1,304 @@
+#ifndef ANALYZE
+#define ANALYZE
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../Common/bitStream.h"
+#include "./audio_utilities.h"
+#include "./batch.h"
+#include "./blocksize.h"
+#include "./encoder.h"
+#include "./rice.h"
+#include "./stereo.h"
+#include "./wide.h"
+
+// Corpus analysis for parameter tuning: the encoder's framing, stereo decision and predictor search run over every
+// file, but the winning codings are only costed, never written, so analysis costs less than an encode. Fixed Taylor
+// degrees (encode lossless <degree>) are projected on request, from the residuals of the search: each one partitions
+// the channel again, and with --high runs the adaptive cascade again. The residuals, predictors and Golomb parameters
+// (m) of the configured search are aggregated over the corpus. Projections are exact: the configured search projects
+// the size lossless encoding writes.
+const int RESIDUAL_HISTOGRAM_RANGE = 1024;  // Residuals from -range to range get a bin each, the rest are counted
+
+struct CorpusAnalysis {
+    std::vector<int> settings;              // Taylor degree of each setting, -1 for the configured search
+    std::vector<uint64_t> projectedBytes;   // Indexed like settings
+    uint64_t inputBytes = 0;
+    uint64_t frames = 0;
+    uint64_t predictors[PREDICTOR_VERBATIM + 1] = {};  // Channels coded with each predictor type
+    std::vector<uint64_t> taylorDegrees = std::vector<uint64_t>(MAX_TAYLOR_DEGREE + 1);
+    std::map<int, uint64_t> lpcOrders;
+    std::map<int, uint64_t> mPartitions, mSamples;  // Partitions coded with each m, and their residuals
+    std::vector<uint64_t> residuals = std::vector<uint64_t>(2 * RESIDUAL_HISTOGRAM_RANGE + 1);
+    uint64_t outOfRange = 0;
+
+    explicit CorpusAnalysis(const std::vector<int> &degrees) {
+        settings.push_back(-1);
+        settings.insert(settings.end(), degrees.begin(), degrees.end());
+        projectedBytes.assign(settings.size(), 0);
+    }
+
+    static std::string settingName(int degree) { return degree < 0 ? "search" : "taylor" + std::to_string(degree); }
+
+    // Fixed degrees of a comma separated list of setting names, all for every degree. search is always projected.
+    static bool parseSettings(const std::string &list, std::vector<int> &degrees) {
+        degrees.clear();
+        std::stringstream names(list);
+        for (std::string name; std::getline(names, name, ',');) {
+            if (name == "search") continue;
+            if (name == "all") {
+                for (int degree = 1; degree <= MAX_TAYLOR_DEGREE; degree++) degrees.push_back(degree);
+                continue;
+            }
+            int degree = 1;
+            while (degree <= MAX_TAYLOR_DEGREE && name != settingName(degree)) degree++;
+            if (degree > MAX_TAYLOR_DEGREE) return false;
+            degrees.push_back(degree);
+        }
+        std::sort(degrees.begin(), degrees.end());
+        degrees.erase(std::unique(degrees.begin(), degrees.end()), degrees.end());
+        return true;
+    }
+
+    void merge(const CorpusAnalysis &other) {
+        for (size_t s = 0; s < settings.size(); s++) projectedBytes[s] += other.projectedBytes[s];
+        inputBytes += other.inputBytes;
+        frames += other.frames;
+        for (int p = 0; p <= PREDICTOR_VERBATIM; p++) predictors[p] += other.predictors[p];
+        for (size_t d = 0; d < taylorDegrees.size(); d++) taylorDegrees[d] += other.taylorDegrees[d];
+        for (const auto &entry : other.lpcOrders) lpcOrders[entry.first] += entry.second;
+        for (const auto &entry : other.mPartitions) mPartitions[entry.first] += entry.second;
+        for (const auto &entry : other.mSamples) mSamples[entry.first] += entry.second;
+        for (size_t i = 0; i < residuals.size(); i++) residuals[i] += other.residuals[i];
+        outOfRange += other.outOfRange;
+    }
+
+    // Predictor, partitions and residuals of a channel chosen by the configured search
+    void addCoding(const ChannelCoding &coding) {
+        predictors[coding.predictor]++;
+        if (coding.predictor == PREDICTOR_CONSTANT || coding.predictor == PREDICTOR_VERBATIM) return;
+        if (coding.predictor == PREDICTOR_TAYLOR) taylorDegrees[coding.taylor_degree]++;
+        if (coding.predictor == PREDICTOR_LPC) lpcOrders[coding.lpc.order]++;
+        const size_t n = coding.residuals.size();
+        const RicePartitioning &partitioning = coding.partitioning;
+        for (size_t j = 0; j < partitioning.parameters.size(); j++) {
+            const int m = riceM(partitioning.parameters[j]);
+            mPartitions[m]++;
+            mSamples[m] += partitionStart(n, partitioning.order, j + 1) - partitionStart(n, partitioning.order, j);
+        }
+        for (int residual : coding.residuals) {
+            if (residual < -RESIDUAL_HISTOGRAM_RANGE || residual > RESIDUAL_HISTOGRAM_RANGE) {
+                outOfRange++;
+            } else {
+                residuals[residual + RESIDUAL_HISTOGRAM_RANGE]++;
+            }
+        }
+    }
+};
+
+// Project the lossless size of one file under every setting, adding it and its statistics to analysis
+bool analyzeFile(const std::string &file_path, const CodecOptions &options, CorpusAnalysis &analysis) {
+    SampleSource source;
+    if (!source.open(file_path, options)) return false;
+    const unsigned int channelCount = source.getChannelCount();
+    const int bitsPerSample = source.getBitsPerSample();
+    if (channelCount == 0 || channelCount > 15 || !isSupportedBitDepth(bitsPerSample)) return false;
+    const size_t window_size = (size_t)channelFrameSize(options) * channelCount;
+
+    // Stream header and end of the frame list, the same under every setting
+    std::ostringstream header;
+    {
+        BitStream stream(header);
+        writeHeader(stream, channelCount, source.getSampleRate(), bitsPerSample, channelFrameSize(options), 0,
+                    AudioEncoder::useInterleaving, options.high_compression);
+        stream.alignToByte();
+    }
+    for (uint64_t &bytes : analysis.projectedBytes) bytes += header.str().size() + FRAME_LENGTH_BITS / 8 + 8;
+    std::error_code error;
+    analysis.inputBytes += std::filesystem::file_size(file_path, error);
+
+    std::vector<ChannelSearch> searches;
+    std::vector<ChannelCoding> codings;
+    ChannelCoding coding;
+    std::vector<std::vector<int32_t>> channels;
+    WideFrame wide;
+    const int coreBits = codedSampleBits(bitsPerSample);
+    // Samples the predictors code, split from 32-bit input as AudioEncoder does
+    auto coreSamples = [&](PcmSpan input) {
+        if (!isWidePcm(bitsPerSample)) return input;
+        splitWideFrame(input, bitsPerSample, wide);
+        return wide.core();
+    };
+    for (PcmSpan windowInput = source.next(window_size); !windowInput.empty(); windowInput = source.next(window_size)) {
+        std::vector<int> frameSizes;
+        if (options.block_effort > 0 && windowInput.size() == window_size) {
+            const PcmSpan core = coreSamples(windowInput);
+            withPcmFormat(coreBits, [&](auto format) { deinterleave<decltype(format)>(core, channelCount, channels); });
+            for (int block : BlockSplitter(channels, options.block_effort).blocks()) frameSizes.push_back(block * channelCount);
+        } else {
+            frameSizes.push_back(windowInput.size());
+        }
+
+        size_t frameStart = 0;
+        for (int frameSize : frameSizes) {
+            const PcmSpan frameInput = windowInput.subspan(frameStart, frameSize);
+            frameStart += frameSize;
+            const PcmSpan core = coreSamples(frameInput);
+            int shift = 0;
+            withPcmFormat(coreBits, [&](auto format) {
+                using Format = decltype(format);
+                shift = wastedBits<Format>(core);
+                deinterleave<Format>(core, channelCount, channels, shift);
+            });
+            if (channelCount == 2) applyStereoMode(chooseStereoMode(channels[0], channels[1]), channels[0], channels[1]);
+
+            // Frame header as AudioEncoder writes it, lossless so without quantization, and the wide extension
+            const uint64_t headerBits = blockSizeBits(frameSize, channelCount) + 4 + 1 +
+                                        (shift > 0 ? WASTED_SHIFT_BITS : 0) + (channelCount == 2 ? STEREO_MODE_BITS : 0) +
+                                        (isWidePcm(bitsPerSample) ? wideExtensionBits(wide, bitsPerSample, true) : 0);
+            chooseFrameCoding(channels, coreBits - shift, -1, 0, AudioEncoder::useInterleaving, options, nullptr,
+                              searches, codings);
+            std::vector<uint64_t> bits(analysis.settings.size(), headerBits);
+            for (size_t c = 0; c < codings.size(); c++) {
+                analysis.addCoding(codings[c]);
+                ChannelSearch &search = searches[c];
+                for (size_t s = 0; s < analysis.settings.size(); s++) {
+                    const int degree = analysis.settings[s];
+                    if (degree < 0 || search.constant) {
+                        bits[s] += PREDICTOR_TYPE_BITS + codings[c].bits;
+                        continue;
+                    }
+                    // The fixed degree coding encode lossless <degree> chooses, from the residuals of the search,
+                    // which no other setting needs. The search moved its winning degree's residuals into the coding
+                    // of the channel, unrefined unless the cascade ran.
+                    coding.predictor = PREDICTOR_TAYLOR;
+                    coding.taylor_degree = degree;
+                    if (codings[c].predictor == PREDICTOR_TAYLOR && codings[c].taylor_degree == degree &&
+                        !options.high_compression) {
+                        coding.residuals.swap(codings[c].residuals);
+                    } else if (degree != search.previousDegree && search.taylorBits[degree] != UINT64_MAX) {
+                        coding.residuals.swap(search.taylorResiduals[degree]);
+                    } else {
+                        taylorResiduals(search.channel, degree, 0, coding.residuals);
+                    }
+                    finishPredictorCoding(search, 0, AudioEncoder::useInterleaving, options, coding);
+                    bits[s] += PREDICTOR_TYPE_BITS + coding.bits;
+                }
+            }
+            for (size_t s = 0; s < analysis.settings.size(); s++) {
+                analysis.projectedBytes[s] += FRAME_LENGTH_BITS / 8 + (bits[s] + 7) / 8;
+            }
+            analysis.frames++;
+        }
+    }
+    return true;
+}
+
+// Analyze every .wav file under a directory, the paths listed one per line in a text file, or a single .wav file,
+// options.jobs files at a time. Prints the projected compression of every setting and writes the distributions as
+// CSV files to the options.output_path directory (./outputs/analysis/ by default). Returns 1 when any file failed.
+int runAnalysis(const std::string &source, const CodecOptions &options) {
+    namespace fs = std::filesystem;
+    if (!fs::exists(source)) {
+        std::cerr << "Analysis input not found: " << source << std::endl;
+        return 1;
+    }
+    std::vector<BatchJob> jobs;
+    std::string extension = fs::path(source).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+    if (!fs::is_directory(source) && extension == ".wav") {
+        jobs.resize(1);
+        jobs[0].input = source;
+    } else {
+        jobs = listBatchJobs(source, "encode", options);
+    }
+    std::stable_sort(jobs.begin(), jobs.end(),
+                     [](const BatchJob &a, const BatchJob &b) { return a.inputBytes > b.inputBytes; });
+
+    CorpusAnalysis total(options.analyze_degrees);
+    std::mutex mutex;
+    const auto start = std::chrono::steady_clock::now();
+    parallelFor(jobs.size(), options.jobs, [&](size_t i) {
+        BatchJob &job = jobs[i];
+        CorpusAnalysis analysis(options.analyze_degrees);
+        std::string failure;
+        try {
+            if (!analyzeFile(job.input.string(), options, analysis)) failure = "unreadable input";
+        } catch (const std::exception &e) {
+            failure = e.what();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        job.ok = failure.empty();
+        if (job.ok) {
+            total.merge(analysis);
+        } else {
+            std::cerr << "Failed: " << job.input.string() << " (" << failure << ")" << std::endl;
+        }
+    });
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const size_t succeeded = std::count_if(jobs.begin(), jobs.end(), [](const BatchJob &job) { return job.ok; });
+
+    const fs::path outputDirectory = options.output_path.empty() ? fs::path("./outputs/analysis/") : fs::path(options.output_path);
+    fs::create_directories(outputDirectory);
+    std::ofstream settingsFile(outputDirectory / "settings.csv");
+    settingsFile << "setting,input_bytes,projected_bytes,ratio\n";
+    for (size_t s = 0; s < total.settings.size(); s++) {
+        settingsFile << CorpusAnalysis::settingName(total.settings[s]) << ',' << total.inputBytes << ','
+                     << total.projectedBytes[s] << ','
+                     << (total.projectedBytes[s] > 0 ? (double)total.inputBytes / total.projectedBytes[s] : 0) << '\n';
+    }
+    std::ofstream histogramFile(outputDirectory / "residual_histogram.csv");
+    histogramFile << "Bin Center,Frequency\n";  // As saveHistogram writes them
+    for (int residual = -RESIDUAL_HISTOGRAM_RANGE; residual <= RESIDUAL_HISTOGRAM_RANGE; residual++) {
+        histogramFile << residual << ',' << total.residuals[residual + RESIDUAL_HISTOGRAM_RANGE] << '\n';
+    }
+    std::ofstream degreeFile(outputDirectory / "taylor_degrees.csv");
+    degreeFile << "degree,channels\n";
+    for (size_t d = 0; d < total.taylorDegrees.size(); d++) degreeFile << d << ',' << total.taylorDegrees[d] << '\n';
+    std::ofstream lpcFile(outputDirectory / "lpc_orders.csv");
+    lpcFile << "order,channels\n";
+    for (const auto &entry : total.lpcOrders) lpcFile << entry.first << ',' << entry.second << '\n';
+    std::ofstream mFile(outputDirectory / "golomb_m.csv");
+    mFile << "m,partitions,residuals\n";
+    for (const auto &entry : total.mPartitions) {
+        mFile << entry.first << ',' << entry.second << ',' << total.mSamples[entry.first] << '\n';
+    }
+
+    const double megabytes = total.inputBytes / 1e6;
+    uint64_t channels = 0;
+    for (uint64_t count : total.predictors) channels += count;
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "Files: " << jobs.size() << ", " << succeeded << " analyzed, " << jobs.size() - succeeded
+              << " failed\n";
+    std::cout << "Input: " << megabytes << " MB, " << total.frames << " frames\n";
+    std::cout << "Setting     Projected MB    Ratio\n";
+    for (size_t s = 0; s < total.settings.size(); s++) {
+        std::cout << std::left << std::setw(10) << CorpusAnalysis::settingName(total.settings[s]) << std::right
+                  << std::setw(14) << total.projectedBytes[s] / 1e6 << std::setw(9)
+                  << (total.projectedBytes[s] > 0 ? (double)total.inputBytes / total.projectedBytes[s] : 0) << '\n';
+    }
+    std::cout << "Search predictors:";
+    for (int p = 0; p <= PREDICTOR_VERBATIM; p++) {
+        std::cout << (p ? ", " : " ") << PREDICTOR_NAMES[p] << ' '
+                  << (channels > 0 ? 100.0 * total.predictors[p] / channels : 0) << '%';
+    }
+    std::cout << "\nResiduals beyond +-" << RESIDUAL_HISTOGRAM_RANGE << ": " << total.outOfRange << '\n';
+    std::cout << "Distributions written to " << outputDirectory.string() << '\n';
+    std::cout << "Time: " << seconds << " s, throughput: " << (seconds > 0 ? megabytes / seconds : 0)
+              << " MB/s of input" << std::endl;
+    return succeeded == jobs.size() ? 0 : 1;
+}
+
+#endif
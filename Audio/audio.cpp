@@ -1,5 +1,3 @@
-#include "./SFML-2.6.2/include/SFML/Audio.hpp"
-
 #include <cmath>
 #include <filesystem>
 #include <iostream>
@@ -7,43 +5,186 @@
 #include <string>
 #include <vector>
 
+#include "./analyze.h"
+#include "./batch.h"
 #include "./decoder.h"
 #include "./encoder.h"
 
 int print_usage(const std::string &program_name) {
   std::cout << "Usage:\n"
-            << "  " << program_name << " <file_path> encode lossy [bitrate] [predictor_degree]\n"
-            << "  " << program_name << " <file_path> encode lossless [predictor_degree]\n"
-            << "  " << program_name << " <file_path> decode\n";
+            << "  " << program_name << " <file_path> encode lossy [bitrate] [predictor_degree] [options]\n"
+            << "  " << program_name << " <file_path> encode lossless [predictor_degree] [options]\n"
+            << "    predictor_degree: fixed Taylor degree from 1 to " << MAX_TAYLOR_DEGREE << " (default: search every predictor)\n"
+            << "  " << program_name << " <file_path> decode [threads] [options]\n"
+            << "    threads: number of decoding threads, 0 uses every core (default: 1 which streams the output)\n"
+            << "  " << program_name << " <file_path> verify [options]\n"
+            << "    Decode in memory and check the source checksum, lossy files report their SNR with --reference\n"
+            << "  " << program_name << " <directory|list_file> batch <encode ...|decode ...|verify> [options]\n"
+            << "    Every .wav (encode) or .g7a (decode, verify) file under the directory, or the paths listed one per line\n"
+            << "  " << program_name << " <directory|list_file|file.wav> analyze [options]\n"
+            << "    Project the lossless size of the configured search without writing a stream, with residual, predictor\n"
+            << "    and Golomb parameter distributions as CSV files (default: ./outputs/analysis/), in less than an encode\n"
+            << "Options:\n"
+            << "  --output <path>                Output file, - for stdout, batch output or analysis directory (default: under ./outputs/)\n"
+            << "  --correction <path>            Hybrid lossy: write the correction restoring the source, or apply it when decoding\n"
+            << "  --stats <path>                 Encoder stage timings and per-frame predictor, degree and Golomb parameter choices,\n"
+            << "                                 as CSV rows for a .csv path, JSON otherwise\n"
+            << "  --reference <path>             Source of the verified file, or a directory mirroring the batch input\n"
+            << "  --raw <sample_rate> <channels> Encode input is raw little-endian PCM, <file_path> may be - for stdin\n"
+            << "  --bits <8|16|24|32|float>      Sample format of --raw input, 8-bit samples are unsigned (default: 16)\n"
+            << "  --lpc <max_order>              Highest LPC order tried when searching predictors, 0 disables (default: 32)\n"
+            << "  --block-effort <0-5>           Pick frame sizes from 8192 down to 8192 >> effort samples per channel (default: 0, fixed)\n"
+            << "  --effort <0-3>                 Predictor search: 3 tries every candidate, 2 climbs from the previous frame's choice,\n"
+            << "                                 1 also ranks on a quarter of the frame, 0 skips LPC (default: 3)\n"
+            << "  --vbv <milliseconds>           Lossy rate control buffer size (default: 1000)\n"
+            << "  --high                         High compression: adaptive filter cascade after the predictors, slower\n"
+            << "  --low-latency <threads>        Evaluate each frame's candidates concurrently on pinned threads, 0 uses every core\n"
+            << "  --settings <list>              Analyze: also project fixed degrees, comma separated taylor1..taylor7 or all.\n"
+            << "                                 Each one adds about 3% of an encode's time, with --high about 20%\n"
+            << "  --jobs <count>                 Files processed concurrently in batch and analyze modes, 0 uses every core (default: 0)\n"
+            << "  --pcm                          Decode to raw PCM of the original sample size instead of WAV (implied on stdout)\n"
+            << "  A <file_path> of - reads the encoded stream from stdin when decoding\n";
   return 1;
 }
 
+// Pull the --options out of the argument list, leaving the positional arguments in args
+int parse_options(int argc, char *argv[], std::vector<std::string> &args, CodecOptions &options) {
+  args.assign(argv, argv + argc);
+  for (size_t i = 1; i < args.size();) {
+    const std::string &arg = args[i];
+    size_t consumed = 1;
+    if (arg == "--output") {
+      if (i + 1 >= args.size()) return print_usage(argv[0]);
+      options.output_path = args[i + 1];
+      consumed = 2;
+    } else if (arg == "--correction") {
+      if (i + 1 >= args.size()) return print_usage(argv[0]);
+      options.correction_path = args[i + 1];
+      consumed = 2;
+    } else if (arg == "--stats") {
+      if (i + 1 >= args.size()) return print_usage(argv[0]);
+      options.stats_path = args[i + 1];
+      consumed = 2;
+    } else if (arg == "--reference") {
+      if (i + 1 >= args.size()) return print_usage(argv[0]);
+      options.reference_path = args[i + 1];
+      consumed = 2;
+    } else if (arg == "--lpc") {
+      if (i + 1 >= args.size()) return print_usage(argv[0]);
+      options.lpc_order = std::stoi(args[i + 1]);
+      if (options.lpc_order < 0 || options.lpc_order > LPC_MAX_ORDER) return print_usage(argv[0]);
+      consumed = 2;
+    } else if (arg == "--block-effort") {
+      if (i + 1 >= args.size()) return print_usage(argv[0]);
+      options.block_effort = std::stoi(args[i + 1]);
+      if (options.block_effort < 0 || options.block_effort > MAX_BLOCK_EFFORT) return print_usage(argv[0]);
+      consumed = 2;
+    } else if (arg == "--effort") {
+      if (i + 1 >= args.size()) return print_usage(argv[0]);
+      options.search_effort = std::stoi(args[i + 1]);
+      if (options.search_effort < 0 || options.search_effort > MAX_SEARCH_EFFORT) return print_usage(argv[0]);
+      consumed = 2;
+    } else if (arg == "--vbv") {
+      if (i + 1 >= args.size()) return print_usage(argv[0]);
+      options.vbv_milliseconds = std::stoi(args[i + 1]);
+      if (options.vbv_milliseconds <= 0) return print_usage(argv[0]);
+      consumed = 2;
+    } else if (arg == "--bits") {
+      if (i + 1 >= args.size()) return print_usage(argv[0]);
+      options.raw_bits = args[i + 1] == "float" ? PCM_FLOAT : std::stoi(args[i + 1]);
+      if (!isSupportedBitDepth(options.raw_bits) || args[i + 1] == std::to_string(PCM_FLOAT)) return print_usage(argv[0]);
+      consumed = 2;
+    } else if (arg == "--low-latency") {
+      if (i + 1 >= args.size()) return print_usage(argv[0]);
+      int threads = std::stoi(args[i + 1]);
+      if (threads < 0) return print_usage(argv[0]);
+      options.low_latency = true;
+      options.latency_threads = threads;
+      consumed = 2;
+    } else if (arg == "--jobs") {
+      if (i + 1 >= args.size()) return print_usage(argv[0]);
+      int jobs = std::stoi(args[i + 1]);
+      if (jobs < 0) return print_usage(argv[0]);
+      options.jobs = jobs;
+      consumed = 2;
+    } else if (arg == "--settings") {
+      if (i + 1 >= args.size()) return print_usage(argv[0]);
+      if (!CorpusAnalysis::parseSettings(args[i + 1], options.analyze_degrees)) return print_usage(argv[0]);
+      consumed = 2;
+    } else if (arg == "--high") {
+      options.high_compression = true;
+    } else if (arg == "--pcm") {
+      options.raw_output = true;
+    } else if (arg == "--raw") {
+      if (i + 2 >= args.size()) return print_usage(argv[0]);
+      options.raw_input = true;
+      int sample_rate = std::stoi(args[i + 1]);
+      int channels = std::stoi(args[i + 2]);
+      if (sample_rate <= 0 || channels <= 0 || channels > 15) return print_usage(argv[0]);
+      options.raw_sample_rate = sample_rate;
+      options.raw_channels = channels;
+      consumed = 3;
+    } else if (arg.rfind("--", 0) == 0) {
+      return print_usage(argv[0]);
+    } else {
+      i++;
+      continue;
+    }
+    args.erase(args.begin() + i, args.begin() + i + consumed);
+  }
+  return 0;
+}
+
 int process_input(int argc, char *argv[], std::string &file_path, std::string &operation, 
-                  std::string &compression_type, int &bitrate, int &predictor_degree) {
+                  std::string &compression_type, int &bitrate, int &predictor_degree, CodecOptions &options,
+                  bool &batch) {
   // Default predictor_degree to -1
   predictor_degree = -1;
+
+  std::vector<std::string> args;
+  if (parse_options(argc, argv, args, options) == 1) return 1;
+  argc = args.size();
   
   if (argc < 3) return print_usage(argv[0]);
-  file_path = argv[1];
-  operation = argv[2];
+  file_path = args[1];
+  operation = args[2];
+
+  // A batch takes the arguments of the operation it runs on each file
+  batch = operation == "batch";
+  if (batch) {
+    args.erase(args.begin() + 2);
+    argc = args.size();
+    if (argc < 3) return print_usage(argv[0]);
+    operation = args[2];
+  }
   
   if (operation == "decode") {
-    if (argc != 3) return print_usage(argv[0]);
+    if (argc == 4) {
+      int threads = std::stoi(args[3]);
+      if (threads < 0) return print_usage(argv[0]);
+      options.threads = threads;
+    } else if (argc != 3) {
+      return print_usage(argv[0]);
+    }
     return 0;
   }
+
+  if (operation == "verify") return argc == 3 ? 0 : print_usage(argv[0]);
+
+  if (operation == "analyze") return argc == 3 && !batch ? 0 : print_usage(argv[0]);
   
   if (operation != "encode") return print_usage(argv[0]);
   
   // Encode operation requires additional parameters
   if (argc < 4) return print_usage(argv[0]);
   
-  compression_type = argv[3];
+  compression_type = args[3];
   
   if (compression_type == "lossless") {
     // Optional predictor_degree
     if (argc == 5) {
-      predictor_degree = std::stoi(argv[4]);
-      if (predictor_degree <= 0) return print_usage(argv[0]);
+      predictor_degree = std::stoi(args[4]);
+      if (predictor_degree <= 0 || predictor_degree > MAX_TAYLOR_DEGREE) return print_usage(argv[0]);
     }
     return 0;
   }
@@ -51,12 +192,12 @@ int process_input(int argc, char *argv[], std::string &file_path, std::string &o
   if (compression_type == "lossy") {
     // Handle both cases: with and without predictor_degree
     if (argc == 5) {
-      bitrate = std::stoi(argv[4]);
+      bitrate = std::stoi(args[4]);
       if (bitrate <= 0) return print_usage(argv[0]);
     } else if (argc == 6) {
-      bitrate = std::stoi(argv[4]);
-      predictor_degree = std::stoi(argv[5]);
-      if (bitrate <= 0 || predictor_degree <= 0) return print_usage(argv[0]);
+      bitrate = std::stoi(args[4]);
+      predictor_degree = std::stoi(args[5]);
+      if (bitrate <= 0 || predictor_degree <= 0 || predictor_degree > MAX_TAYLOR_DEGREE) return print_usage(argv[0]);
     } else {
       return print_usage(argv[0]);
     }
@@ -70,9 +211,12 @@ int process_input(int argc, char *argv[], std::string &file_path, std::string &o
 int main(int argc, char *argv[]) {
   std::string file_path, operation, compression_type;
   int predictor_degree, bitrate = 0;
+  CodecOptions options;
+  bool batch = false;
 
 #if 1
-  if (process_input(argc, argv, file_path, operation, compression_type, bitrate, predictor_degree) == 1) return 1;
+  if (process_input(argc, argv, file_path, operation, compression_type, bitrate, predictor_degree, options, batch) == 1)
+    return 1;
 #else
   file_path = "./datasets/sample01.wav";
   operation = "encode";
@@ -80,9 +224,15 @@ int main(int argc, char *argv[]) {
   bitrate = 0;
 #endif
 
-  if (operation == "encode") {
-    return encode(file_path, compression_type, bitrate, predictor_degree);
+  if (operation == "analyze") {
+    return runAnalysis(file_path, options);
+  } else if (batch) {
+    return runBatch(file_path, operation, compression_type, bitrate, predictor_degree, options);
+  } else if (operation == "encode") {
+    return encode(file_path, compression_type, bitrate, predictor_degree, options);
   } else if (operation == "decode") {
-    return decode(file_path);
+    return decode(file_path, options);
+  } else if (operation == "verify") {
+    return verify(file_path, options);
   }
 }
\ No newline at end of file
@@ -1,30 +1,349 @@
 #ifndef AUDIO_UTILITIES
 #define AUDIO_UTILITIES
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
-#include <unordered_map>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
-void printAudioInfo(const sf::SoundBuffer &buffer) {
-    std::cout << "Audio File Information:" << std::endl;
-    std::cout << "Sample Rate: " << buffer.getSampleRate() << " Hz" << std::endl;
-    std::cout << "Channel Count: " << buffer.getChannelCount() << std::endl;
-    std::cout << "Duration: " << buffer.getDuration().asSeconds() << " seconds" << std::endl;
-    std::cout << "Sample Count: " << buffer.getSampleCount() << std::endl;
-    std::cout << "Sample Size: " << sizeof(sf::Int16) * 8 << " bits" << std::endl;
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "../Common/bitStream.h"
+#include "./wav_io.h"
+
+// Settings shared by the command line modes, the defaults reproduce the original behaviour
+struct CodecOptions {
+    std::string output_path;        // Empty picks the default location under ./outputs/, "-" is stdout
+    std::string reference_path;     // Source a lossy stream is compared with when verifying
+    std::string correction_path;    // Hybrid coding: correction stream written next to a lossy encode, or applied
+                                    // when decoding to restore the source exactly
+    std::string stats_path;         // Encoder stage timings and per-frame decisions, CSV for a .csv path, else JSON
+    bool raw_input = false;         // Input is headerless interleaved little-endian PCM
+    bool raw_output = false;        // Decode to headerless PCM instead of WAV (always the case on stdout)
+    unsigned int raw_sample_rate = 0;
+    unsigned int raw_channels = 0;
+    int raw_bits = 16;              // Raw input sample format: 8 (unsigned), 16, 24, 32 or PCM_FLOAT
+    unsigned int threads = 1;       // Decoding threads, 0 uses every core
+    bool low_latency = false;       // Evaluate the candidate codings of each frame concurrently
+    unsigned int latency_threads = 0;  // Threads of the low latency worker group, 0 uses every core
+    int lpc_order = 32;             // Highest LPC order tried when searching predictors, 0 disables LPC
+    int vbv_milliseconds = 1000;    // Lossy rate control buffer, how long the bitrate may run above target
+    int block_effort = 0;           // Block size search depth (halvings of the largest block), 0 keeps fixed frames
+    int search_effort = 3;          // Predictor search effort, 3 evaluates every candidate
+    bool high_compression = false;  // Cascade adaptive filters after the fixed predictor, slower but smaller
+    bool quiet = false;             // No stream information or stage timings on the console
+    unsigned int jobs = 0;          // Files processed concurrently in batch and analyze modes, 0 uses every core
+    std::vector<int> analyze_degrees;  // Fixed Taylor degrees analyze projects besides the configured search
+};
+
+// How a channel of a frame is coded, stored in its header. Constant channels (digital silence, DC) keep only their
+// value and verbatim channels their raw samples, which bounds the size of frames that prediction would expand.
+enum PredictorType { PREDICTOR_TAYLOR = 0, PREDICTOR_LPC = 1, PREDICTOR_CONSTANT = 2, PREDICTOR_VERBATIM = 3 };
+const char *const PREDICTOR_NAMES[] = {"taylor", "lpc", "constant", "verbatim"};
+const int PREDICTOR_TYPE_BITS = 2;
+const int STORED_WIDTH_BITS = 5;  // Bits per stored sample, minus one
+
+// Frames are predicted as int32 samples whatever the input width, the side channel of a stereo pair needs one bit
+// more than the widest (24-bit) input
+const int32_t WORK_SAMPLE_MIN = -(1 << 24);
+const int32_t WORK_SAMPLE_MAX = (1 << 24) - 1;
+
+inline int32_t clampWorkSample(int64_t sample) {
+    return (int32_t)std::max<int64_t>(WORK_SAMPLE_MIN, std::min<int64_t>(WORK_SAMPLE_MAX, sample));
 }
 
-void saveWav(const std::vector<sf::Int16> &samples, unsigned int sampleRate, unsigned int channelCount, const std::string &filename) {
-    sf::SoundBuffer buffer;
-    buffer.loadFromSamples(samples.data(), samples.size(), channelCount, sampleRate);
-    std::string output_directory = "./outputs/wav_audio/";
-    std::filesystem::create_directory("./outputs/");
-    std::filesystem::create_directory(output_directory);
-    if (!buffer.saveToFile(output_directory + filename)) {
-        std::cerr << "Failed to save WAV file: " << filename << std::endl;
+// Smallest and largest sample of a channel
+inline void sampleRange(Span<const int32_t> channel, int32_t &minimum, int32_t &maximum) {
+    const int32_t *data = channel.data();
+    const size_t n = channel.size();
+    int32_t lo = n ? data[0] : 0, hi = lo;
+#pragma omp simd reduction(min : lo) reduction(max : hi)
+    for (size_t i = 0; i < n; i++) {
+        lo = std::min(lo, data[i]);
+        hi = std::max(hi, data[i]);
+    }
+    minimum = lo;
+    maximum = hi;
+}
+
+// Two's complement bits needed to hold every sample between minimum and maximum
+inline int sampleWidth(int32_t minimum, int32_t maximum) {
+    int width = 1;
+    while (minimum < -(1 << (width - 1)) || maximum > (1 << (width - 1)) - 1) width++;
+    return width;
+}
+
+// Read a two's complement value of the given width
+inline int32_t readSigned(BitStream &stream, int width) {
+    int32_t value = stream.readBits(width);
+    if (value >> (width - 1)) value -= 1 << width;  // Sign extend
+    return value;
+}
+
+// Samples stored as is, at the narrowest width that holds them (every sample of a verbatim channel)
+inline uint64_t storedSampleBits(Span<const int32_t> samples) {
+    int32_t minimum, maximum;
+    sampleRange(samples, minimum, maximum);
+    return STORED_WIDTH_BITS + (uint64_t)samples.size() * sampleWidth(minimum, maximum);
+}
+
+void writeStoredSamples(BitStream &stream, Span<const int32_t> samples) {
+    int32_t minimum, maximum;
+    sampleRange(samples, minimum, maximum);
+    const int width = sampleWidth(minimum, maximum);
+    stream.writeBits(width - 1, STORED_WIDTH_BITS);
+    for (int32_t sample : samples) stream.writeBits(static_cast<uint32_t>(sample), width);
+}
+
+void readStoredSamples(BitStream &stream, int32_t *output, size_t n) {
+    const int width = stream.readBits(STORED_WIDTH_BITS) + 1;
+    for (size_t i = 0; i < n; i++) output[i] = readSigned(stream, width);
+}
+
+// Warm-up samples keep the first sample as is and the others as differences from their predecessor, each part
+// at its own width
+inline std::vector<int32_t> warmupDifferences(Span<const int32_t> samples) {
+    std::vector<int32_t> differences(samples.begin(), samples.end());
+    for (size_t i = differences.size(); i-- > 1;) differences[i] -= differences[i - 1];
+    return differences;
+}
+
+inline uint64_t warmupBits(Span<const int32_t> samples) {
+    if (samples.empty()) return 0;
+    const std::vector<int32_t> differences = warmupDifferences(samples);
+    const Span<const int32_t> all(differences.data(), differences.size());
+    return storedSampleBits(all.subspan(0, 1)) + (all.size() > 1 ? storedSampleBits(all.subspan(1, all.size() - 1)) : 0);
+}
+
+void writeWarmup(BitStream &stream, Span<const int32_t> samples) {
+    if (samples.empty()) return;
+    const std::vector<int32_t> differences = warmupDifferences(samples);
+    const Span<const int32_t> all(differences.data(), differences.size());
+    writeStoredSamples(stream, all.subspan(0, 1));
+    if (all.size() > 1) writeStoredSamples(stream, all.subspan(1, all.size() - 1));
+}
+
+void readWarmup(BitStream &stream, int32_t *output, size_t n) {
+    if (n == 0) return;
+    readStoredSamples(stream, output, 1);
+    if (n > 1) readStoredSamples(stream, output + 1, n - 1);
+    for (size_t i = 1; i < n; i++) output[i] += output[i - 1];
+}
+
+// Feed a predictor (TaylorFilter, LpcFilter) the warm-up samples at the start of a channel, returns their number.
+// A predicted channel begins with as many samples as its predictor looks back, so prediction never starts from
+// nothing and the first residuals of a frame are as small as the others.
+template <typename Filter>
+size_t pushWarmup(Filter &filter, Span<const int32_t> channel) {
+    const size_t warmup = std::min(channel.size(), (size_t)filter.warmupLength());
+    for (size_t i = 0; i < warmup; i++) filter.push(0, channel[i]);
+    return warmup;
+}
+
+// Frames are coded one channel at a time, sample i of an interleaved frame belonging to channel i % channelCount.
+// Number of samples of the channel in a frame of frameSize interleaved samples
+inline int channelLength(int frameSize, int channelCount, int channel) {
+    return (frameSize - channel + channelCount - 1) / channelCount;
+}
+
+// Low-resolution material padded to 16 bits (8 or 12-bit sources) leaves trailing zero bits in every sample.
+// Frames shift them out before prediction and store the shift in their header behind a one-bit flag.
+const int WASTED_SHIFT_BITS = 4;
+
+// Number of trailing zero bits shared by every sample of a frame, 0 for a silent frame
+template <typename Format>
+int wastedBits(PcmSpan frame) {
+    const unsigned char *in = frame.data();
+    const size_t n = frame.size();
+    const int width = Format::BITS / 8;
+    uint32_t bits = 0;
+#pragma omp simd reduction(| : bits)
+    for (size_t i = 0; i < n; i++) bits |= (uint32_t)Format::load(in + i * width);
+    return bits ? std::min(__builtin_ctz(bits), (1 << WASTED_SHIFT_BITS) - 1) : 0;
+}
+
+// Split an interleaved frame into contiguous per-channel buffers of working samples, dropping shift wasted bits
+template <typename Format>
+void deinterleave(PcmSpan frame, int channelCount, std::vector<std::vector<int32_t>> &channels, int shift = 0) {
+    channels.resize(channelCount);
+    const unsigned char *in = frame.data();
+    const int width = Format::BITS / 8;
+    for (int c = 0; c < channelCount; c++) {
+        const int n = channelLength(frame.size(), channelCount, c);
+        channels[c].resize(n);
+        int32_t *out = channels[c].data();
+#pragma omp simd
+        for (int j = 0; j < n; j++) out[j] = Format::load(in + ((size_t)j * channelCount + c) * width) >> shift;
+    }
+}
+
+// Interleave per-channel buffers back into PCM samples, restoring shift wasted bits and clamping lossy
+// reconstructions that overshoot
+template <typename Format>
+void interleave(const std::vector<std::vector<int32_t>> &channels, unsigned char *output, int shift = 0) {
+    const int channelCount = channels.size();
+    const int width = Format::BITS / 8;
+    const int32_t lo = -(1 << (Format::BITS - 1)) >> shift, hi = ((1 << (Format::BITS - 1)) - 1) >> shift;
+    for (int c = 0; c < channelCount; c++) {
+        const int n = channels[c].size();
+        const int32_t *in = channels[c].data();
+#pragma omp simd
+        for (int j = 0; j < n; j++) {
+            const int32_t sample = std::max(lo, std::min(hi, in[j])) * (1 << shift);
+            Format::store(output + ((size_t)j * channelCount + c) * width, sample);
+        }
+    }
+}
+
+// Sample count stored in the header when the encoder could not seek back to fill it in
+const uint32_t STREAMING_LENGTH = 0xFFFFFFFF;
+
+// Make stdin/stdout safe for binary data
+void setBinaryMode(FILE *file) {
+#ifdef _WIN32
+    _setmode(_fileno(file), _O_BINARY);
+#else
+    (void)file;
+#endif
+}
+
+// Pulls interleaved samples a chunk at a time, from a WAV file (memory mapped, the chunks point straight into the
+// mapping) or from raw PCM (a file or "-" for stdin, copied through a one-chunk buffer)
+class SampleSource {
+   private:
+    WavReader wavFile;
+    size_t position = 0;
+    std::ifstream rawFile;
+    std::istream *raw = nullptr;
+    std::vector<unsigned char> rawBuffer;
+    unsigned int channelCount = 0;
+    unsigned int sampleRate = 0;
+    int bitsPerSample = 16;
+    uint64_t sampleCount = STREAMING_LENGTH;  // Unknown for raw PCM
+
+   public:
+    bool open(const std::string &file_path, const CodecOptions &options) {
+        if (!options.raw_input) {
+            if (!wavFile.open(file_path)) {
+                std::cerr << "WAV error: " << wavFile.getError() << std::endl;
+                return false;
+            }
+            channelCount = wavFile.getChannelCount();
+            sampleRate = wavFile.getSampleRate();
+            bitsPerSample = wavFile.getBitsPerSample();
+            sampleCount = wavFile.getSampleCount();
+            return true;
+        }
+        if (file_path == "-") {
+            setBinaryMode(stdin);
+            raw = &std::cin;
+        } else {
+            rawFile.open(file_path, std::ios::in | std::ios::binary);
+            if (!rawFile.is_open()) return false;
+            raw = &rawFile;
+        }
+        channelCount = options.raw_channels;
+        sampleRate = options.raw_sample_rate;
+        bitsPerSample = options.raw_bits;
+        return true;
+    }
+
+    // Next chunk of up to maxCount samples, shorter only at the end of the input and empty once it is exhausted.
+    // The chunk stays valid until the following call.
+    PcmSpan next(size_t maxCount) {
+        if (!raw) {
+            PcmSpan samples = wavFile.samples();
+            size_t count = std::min(maxCount, samples.size() - position);
+            position += count;
+            return samples.subspan(position - count, count);
+        }
+        const int bytesPerSample = pcmBytes(bitsPerSample);
+        rawBuffer.resize(maxCount * bytesPerSample);
+        raw->read(reinterpret_cast<char *>(rawBuffer.data()), rawBuffer.size());
+        return PcmSpan(rawBuffer.data(), raw->gcount() / bytesPerSample, bytesPerSample);
     }
+
+    unsigned int getChannelCount() const { return channelCount; }
+    unsigned int getSampleRate() const { return sampleRate; }
+    int getBitsPerSample() const { return bitsPerSample; }
+    uint64_t getSampleCount() const { return sampleCount; }
+};
+
+void printAudioInfo(const SampleSource &source, std::ostream &out = std::cout) {
+    out << "Audio File Information:" << std::endl;
+    out << "Sample Rate: " << source.getSampleRate() << " Hz" << std::endl;
+    out << "Channel Count: " << source.getChannelCount() << std::endl;
+    if (source.getSampleCount() != STREAMING_LENGTH) {
+        out << "Duration: " << (double)source.getSampleCount() / (source.getSampleRate() * source.getChannelCount()) << " seconds" << std::endl;
+        out << "Sample Count: " << source.getSampleCount() << std::endl;
+    } else {
+        out << "Duration: unknown (streaming input)" << std::endl;
+    }
+    out << "Sample Size: " << pcmFormatName(source.getBitsPerSample()) << std::endl;
 }
 
-void saveHistogram(const std::vector<sf::Int16> &data, const std::string &title, int num_bins) {
+// Receives decoded samples a chunk at a time, as a WAV file (sizes are filled in on close)
+// or as raw PCM (a file or "-" for stdout)
+class SampleSink {
+   private:
+    WavWriter wavFile;
+    std::ofstream rawFile;
+    std::ostream *raw = nullptr;
+    int bytesPerSample = 2;
+
+   public:
+    bool open(const std::string &file_path, unsigned int sampleRate, unsigned int channelCount, int bitsPerSample,
+              bool rawOutput) {
+        bytesPerSample = pcmBytes(bitsPerSample);
+        if (file_path == "-") {
+            setBinaryMode(stdout);
+            raw = &std::cout;
+            return true;
+        }
+        if (!rawOutput) return wavFile.open(file_path, sampleRate, channelCount, bitsPerSample);
+        rawFile.open(file_path, std::ios::out | std::ios::binary);
+        raw = &rawFile;
+        return rawFile.is_open();
+    }
+
+    // Write count samples already in their PCM container
+    void write(const unsigned char *samples, size_t count) {
+        if (!raw) {
+            wavFile.write(samples, count * bytesPerSample);
+        } else {
+            raw->write(reinterpret_cast<const char *>(samples), count * bytesPerSample);
+        }
+    }
+
+    void close() {
+        if (!raw) {
+            wavFile.close();
+        } else {
+            raw->flush();
+        }
+    }
+};
+
+void saveHistogram(const std::vector<int16_t> &data, const std::string &title, int num_bins) {
     auto [min_it, max_it] = std::minmax_element(data.begin(), data.end());
     double min_val = *min_it;
     double max_val = *max_it;
@@ -57,13 +376,13 @@ void saveHistogram(const std::vector<sf::Int16> &data, const std::string &title,
     outfile.close();
 }
 
-sf::Int16 predictor_basic(const std::vector<sf::Int16> &recentSamples) { return recentSamples[recentSamples.size()]; }
+int16_t predictor_basic(const std::vector<int16_t> &recentSamples) { return recentSamples[recentSamples.size()]; }
 
 /*
 // Generalized implementation for degree n of FLAC polinomial predictor (it's only one term of the taylor series)
 // page 44 on https://www.ietf.org/archive/id/draft-ietf-cellar-flac-08.pdf 
 // Results:  13.9086  11.7264  11.3132  11.6488  12.2604  12.981  13.7429  14.4952 Taylor degree with least entropy: 2
-sf::Int16 predictor_taylor(int degree, int channelCount, const std::vector<sf::Int16> &recentSamples) {
+int16_t predictor_taylor(int degree, int channelCount, const std::vector<int16_t> &recentSamples) {
     if (recentSamples.size() / channelCount == 0) {
         return 0;  // No recent samples, return 0
     }
@@ -87,46 +406,99 @@ sf::Int16 predictor_taylor(int degree, int channelCount, const std::vector<sf::I
     }
     predicted = std::max(predicted, (float)(-(1 << 15)));
     predicted = std::min(predicted, (float)(1 << 15 - 1));
-    return static_cast<sf::Int16>(std::round(predicted));
+    return static_cast<int16_t>(std::round(predicted));
 }
 */
 
 // My original version (my degrees are one less than the correspondent FLAC)
 // Results:  11.7264  11.3132  11.3521  11.3627  11.3551  11.3474  11.3437  11.3426 Taylor degree with least entropy: 1
-sf::Int16 predictor_taylor(int degree, int channelCount, const std::vector<sf::Int16> &recentSamples) {
-    if (recentSamples.size() / channelCount == 0) {
+// The prediction is a fixed linear combination of the previous degree + 1 samples: the sum over n <= degree of the
+// n-th backward difference divided by n!. Scaled by 7! every weight is an integer, so it runs in exact arithmetic.
+const int MAX_TAYLOR_DEGREE = 7;
+const int64_t TAYLOR_WEIGHT_SCALE = 5040;  // 7!
+
+// weights[degree][i] multiplies the sample i + 1 positions back
+const std::vector<std::vector<int32_t>> &taylorWeights() {
+    static const std::vector<std::vector<int32_t>> weights = [] {
+        std::vector<int64_t> factorial(MAX_TAYLOR_DEGREE + 1, 1);
+        for (int i = 1; i <= MAX_TAYLOR_DEGREE; ++i) factorial[i] = factorial[i - 1] * i;
+        std::vector<std::vector<int32_t>> table(MAX_TAYLOR_DEGREE + 1);
+        for (int degree = 0; degree <= MAX_TAYLOR_DEGREE; ++degree) {
+            table[degree].assign(degree + 1, 0);
+            for (int n = 0; n <= degree; ++n) {
+                for (int i = 0; i <= n; ++i) {
+                    int64_t binomial = factorial[n] / (factorial[i] * factorial[n - i]);
+                    int64_t sign = (i % 2 == 0) ? 1 : -1;  // Alternating signs
+                    table[degree][i] += sign * binomial * (TAYLOR_WEIGHT_SCALE / factorial[n]);
+                }
+            }
+        }
+        return table;
+    }();
+    return weights;
+}
+
+// Prediction for the sample following history[0 .. count - 1] of a single channel (oldest first)
+int32_t predictor_taylor(int degree, const int32_t *history, int count) {
+    if (count == 0) {
         return 0;  // No recent samples, return 0
     }
-    if (degree >= recentSamples.size() / channelCount) {
-        return recentSamples[recentSamples.size() - channelCount];  // Not enough samples for a prediction, return last sample
+    if (degree >= count) {
+        return history[count - 1];  // Not enough samples for a prediction, return last sample
     }
-    // Precompute factorial values
-    std::vector<int> factorial(degree + 1);
-    factorial[0] = 1;
-    for (int i = 1; i <= degree; ++i) {
-        factorial[i] = factorial[i - 1] * i;
+    const int32_t *weights = taylorWeights()[degree].data();
+    const int32_t *last = history + count - 1;
+    int64_t sum = 0;
+    for (int i = 0; i <= degree; ++i) {
+        sum += (int64_t)weights[i] * last[-i];
     }
-    // Compute Taylor terms approximating derivatives using finite differences (backward Euler method)
-    float predicted = 0;
-    for (int n = 0; n <= degree; ++n) {
-        float nth_term = 0;
-        for (int i = 0; i <= n; ++i) {
-            float sign = (i % 2 == 0) ? 1 : -1;  // Alternating signs
-            float ith_prev_sample = recentSamples[recentSamples.size() - (1 + i) * channelCount];
-            float binomial = factorial[n] / (factorial[i] * factorial[n - i]);
-            nth_term += sign * ith_prev_sample * binomial;
-        }
-        predicted += nth_term / factorial[n];
+    // Round to nearest, halves away from zero
+    int64_t half = TAYLOR_WEIGHT_SCALE / 2;
+    int64_t predicted = sum >= 0 ? (sum + half) / TAYLOR_WEIGHT_SCALE : -((-sum + half) / TAYLOR_WEIGHT_SCALE);
+    return clampWorkSample(predicted);
+}
+
+// Taylor predictor over one channel of a frame behind the same interface as LpcFilter
+class TaylorFilter {
+   private:
+    int degree;
+    std::vector<int32_t> samples;  // Reconstructed samples of the channel so far
+
+   public:
+    TaylorFilter(int degree, int laneLength) : degree(degree) { samples.reserve(laneLength); }
+
+    // Samples before the first full prediction, degree + 1 of them
+    int warmupLength() const { return degree + 1; }
+
+    int32_t predict() const { return predictor_taylor(degree, samples.data(), samples.size()); }
+
+    int32_t push(int32_t predicted, int32_t residual) {
+        int32_t sample = clampWorkSample((int64_t)predicted + residual);
+        samples.push_back(sample);
+        return sample;
+    }
+};
+
+// Residual in steps of 2^q_bits, rounded to the nearest step so a lossy reconstruction is off by at most half a step
+inline int quantizeResidual(int difference, int q_bits) { return (difference + ((1 << q_bits) >> 1)) >> q_bits; }
+
+// Quantized residuals of one channel under the given Taylor degree, following its warm-up samples
+void taylorResiduals(Span<const int32_t> channel, int degree, int q_bits, std::vector<int> &residuals) {
+    TaylorFilter filter(degree, channel.size());
+    const size_t warmup = pushWarmup(filter, channel);
+    residuals.resize(channel.size() - warmup);
+    for (size_t i = warmup; i < channel.size(); i++) {
+        int32_t predicted = filter.predict();
+        int residual = quantizeResidual(channel[i] - predicted, q_bits);
+        residuals[i - warmup] = residual;
+        filter.push(predicted, residual << q_bits);
     }
-    predicted = std::max(predicted, (float)(-(1 << 15)));
-    predicted = std::min(predicted, (float)(1 << 15 - 1));
-    return static_cast<sf::Int16>(std::round(predicted));
 }
 
 
 /*
 // Hardcoded FLAC version
-sf::Int16 predictor_taylor(int degree, int channelCount, const std::vector<sf::Int16> &recentSamples) {
+int16_t predictor_taylor(int degree, int channelCount, const std::vector<int16_t> &recentSamples) {
     if (recentSamples.size() / channelCount == 0) {
         return 0;  // No recent samples, return 0
     }
@@ -145,47 +517,179 @@ sf::Int16 predictor_taylor(int degree, int channelCount, const std::vector<sf::I
         predicted = 4*recentSamples[recentSamples.size() - channelCount] - 6*recentSamples[recentSamples.size() - 2*channelCount] + 4*recentSamples[recentSamples.size() - 3*channelCount] - recentSamples[recentSamples.size() - 4*channelCount];
     }
     
-    return static_cast<sf::Int16>(std::round(predicted));
+    return static_cast<int16_t>(std::round(predicted));
 }
 */
 
-void writeHeader(BitStream &stream, uint8_t channels, uint16_t sampling_freq, uint16_t frame_size, uint32_t num_samples,
-                 bool useInterleaving) {
-    stream.writeBits(channels, 4);        // Up to 15 channels
-    stream.writeBits(sampling_freq, 16);  // Up to 65khz sampling frequency
-    stream.writeBits(frame_size, 16);     // Up to 65k samples per frame
+void writeHeader(BitStream &stream, uint8_t channels, uint32_t sampling_freq, uint8_t bits_per_sample,
+                 uint16_t frame_size, uint32_t num_samples, bool useInterleaving, bool useNlms) {
+    stream.writeBits(channels, 4);             // Up to 15 channels
+    stream.writeBits(sampling_freq, 32);       // Any sampling frequency
+    stream.writeBits(8 * pcmBytes(bits_per_sample) - 1, 5);  // Input PCM width, up to 32 bits
+    stream.writeBits(frame_size, 16);          // Up to 65k samples per channel in the largest frame
     stream.writeBits(num_samples, 32);    // Up to 27 hours of mono audio at 44100hz
     stream.writeBits(useInterleaving, 1);
+    stream.writeBits(useNlms, 1);         // Adaptive filter cascade after the fixed predictors
+    stream.writeBits(bits_per_sample == PCM_FLOAT, 1);  // 32-bit float samples
 }
 
-void readHeader(BitStream &stream, uint8_t &channels, uint16_t &sampling_freq, uint16_t &frame_size, uint32_t &num_samples,
-                bool &useInterleaving) {
+void readHeader(BitStream &stream, uint8_t &channels, uint32_t &sampling_freq, uint8_t &bits_per_sample,
+                uint16_t &frame_size, uint32_t &num_samples, bool &useInterleaving, bool &useNlms) {
     channels = stream.readBits(4);
-    sampling_freq = stream.readBits(16);
+    sampling_freq = stream.readBits(32);
+    bits_per_sample = stream.readBits(5) + 1;
     frame_size = stream.readBits(16);
     num_samples = stream.readBits(32);
     useInterleaving = stream.readBits(1);
+    useNlms = stream.readBits(1);
+    if (stream.readBits(1)) bits_per_sample = bits_per_sample == 32 ? PCM_FLOAT : 0;  // 0 is rejected by the reader
+}
+
+// Frames are stored as byte-aligned blocks prefixed by their length in bytes.
+// A zero length ends the frame list and is followed by the total sample count and the CRC-32C of the source PCM
+// (interleaved samples in their container), which the encoder only knows once the input has been read.
+const int FRAME_LENGTH_BITS = 32;
+
+void writeFrame(BitStream &stream, const std::string &frameBytes) {
+    stream.writeBits(frameBytes.size(), FRAME_LENGTH_BITS);
+    stream.writeBytes(frameBytes.data(), frameBytes.size());
+}
+
+void writeEndOfFrames(BitStream &stream, uint32_t num_samples, uint32_t checksum) {
+    stream.writeBits(0, FRAME_LENGTH_BITS);
+    stream.writeBits(num_samples, 32);
+    stream.writeBits(checksum, 32);
 }
 
-double get_entropy(const std::vector<int> &frameResiduals) {
-    // Create a map to store the frequency of each value
-    std::unordered_map<int, int> value_count;
+// Run task(0) .. task(count - 1) on up to num_threads worker threads, each one pulling the next index when done.
+// The first exception thrown by a task is rethrown once every worker has stopped.
+void parallelFor(size_t count, unsigned int num_threads, const std::function<void(size_t)> &task) {
+    if (num_threads == 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+    num_threads = std::min<size_t>(num_threads, std::max<size_t>(count, 1));
 
-    // Count the frequency of each value
-    for (int value : frameResiduals) {
-        value_count[value]++;
+    std::atomic<size_t> next(0);
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            try {
+                task(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error) error = std::current_exception();
+                next = count;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int t = 1; t < num_threads; t++) threads.emplace_back(worker);
+    worker();
+    for (std::thread &thread : threads) thread.join();
+    if (error) std::rethrow_exception(error);
+}
+
+// A fixed group of worker threads, each pinned to its own core, that runs batches of small tasks. Unlike
+// parallelFor the threads outlive a batch, so a batch costs a wake-up instead of thread creation and can be
+// issued for every frame. The calling thread takes part in each batch.
+class WorkerGroup {
+   private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake, finished;
+    const std::function<void(size_t)> *task = nullptr;
+    size_t count = 0;
+    std::atomic<size_t> next{0};
+    uint64_t batch = 0;       // Incremented for every batch, workers wait for a new one
+    unsigned int active = 0;  // Workers still inside the current batch
+    bool stopping = false;
+    std::exception_ptr error;
+
+    void work() {
+        for (size_t i = next++; i < count; i = next++) {
+            try {
+                (*task)(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error) error = std::current_exception();
+                next = count;
+            }
+        }
     }
 
-    double total_count = frameResiduals.size();
-    double entropy = 0.0;
+    static void pin(std::thread &thread, unsigned int core) {
+#ifdef __linux__
+        cpu_set_t cores;
+        CPU_ZERO(&cores);
+        CPU_SET(core % std::max(1u, std::thread::hardware_concurrency()), &cores);
+        pthread_setaffinity_np(thread.native_handle(), sizeof(cores), &cores);
+#else
+        (void)thread;
+        (void)core;
+#endif
+    }
 
-    // Calculate the entropy
-    for (const auto &[value, count] : value_count) {
-        double probability = count / total_count;
-        entropy -= probability * std::log2(probability);
+   public:
+    // num_threads counts the calling thread, 0 uses every core
+    explicit WorkerGroup(unsigned int num_threads) {
+        if (num_threads == 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned int t = 1; t < num_threads; t++) {
+            threads.emplace_back([this]() {
+                uint64_t seen = 0;
+                while (true) {
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        wake.wait(lock, [&]() { return stopping || batch != seen; });
+                        if (stopping) return;
+                        seen = batch;
+                    }
+                    work();
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (--active == 0) finished.notify_one();
+                }
+            });
+            pin(threads.back(), t);
+        }
     }
 
-    return entropy;
+    WorkerGroup(const WorkerGroup &) = delete;
+    WorkerGroup &operator=(const WorkerGroup &) = delete;
+
+    ~WorkerGroup() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &thread : threads) thread.join();
+    }
+
+    // Run body(0) .. body(n - 1) and return once all of them are done, rethrowing the first exception
+    void run(size_t n, const std::function<void(size_t)> &body) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = &body;
+            count = n;
+            next = 0;
+            error = nullptr;
+            active = threads.size();
+            batch++;
+        }
+        wake.notify_all();
+        work();
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&]() { return active == 0; });
+        if (error) std::rethrow_exception(error);
+    }
+};
+
+// Run body(0) .. body(n - 1) on the worker group, or in order on the calling thread without one
+inline void runTasks(WorkerGroup *workers, size_t n, const std::function<void(size_t)> &body) {
+    if (workers) {
+        workers->run(n, body);
+    } else {
+        for (size_t i = 0; i < n; i++) body(i);
+    }
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,161 @@
+#ifndef BATCH
+#define BATCH
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "./audio_utilities.h"
+#include "./decoder.h"
+#include "./encoder.h"
+
+// One file of a batch: where it is read from and written to (or compared with when verifying), and how it went
+struct BatchJob {
+    std::filesystem::path input;
+    std::filesystem::path output;
+    std::filesystem::path reference;
+    uintmax_t inputBytes = 0;
+    uintmax_t outputBytes = 0;
+    bool ok = false;
+};
+
+// Input files of a batch: the files under a directory (recursively) that the operation reads, or the paths listed
+// one per line in a text file. Outputs keep their path relative to the directory, or just their name for a list,
+// and so do the references of verified files under options.reference_path.
+std::vector<BatchJob> listBatchJobs(const std::filesystem::path &source, const std::string &operation,
+                                    const CodecOptions &options) {
+    namespace fs = std::filesystem;
+    const bool encoding = operation == "encode";
+    const fs::path outputDirectory = !options.output_path.empty() ? fs::path(options.output_path)
+                                     : encoding                  ? fs::path("./outputs/encoded_audio/")
+                                                                 : fs::path("./outputs/wav_audio/");
+    auto outputFor = [&](const fs::path &relative) {
+        fs::path output = outputDirectory / relative.parent_path() / relative.stem();
+        output += encoding ? ".g7a" : options.raw_output ? "_decoded.raw" : "_decoded.wav";
+        return output;
+    };
+    auto referenceFor = [&](const fs::path &relative) {
+        if (options.reference_path.empty() || operation != "verify") return fs::path();
+        return fs::path(options.reference_path) / relative.parent_path() / (relative.stem().string() + ".wav");
+    };
+
+    std::vector<BatchJob> jobs;
+    if (fs::is_directory(source)) {
+        for (const fs::directory_entry &entry : fs::recursive_directory_iterator(source)) {
+            if (!entry.is_regular_file()) continue;
+            std::string extension = entry.path().extension().string();
+            std::transform(extension.begin(), extension.end(), extension.begin(),
+                           [](unsigned char c) { return std::tolower(c); });
+            // Raw PCM has no extension of its own, every file of the directory is taken
+            if (encoding ? !options.raw_input && extension != ".wav" : extension != ".g7a") continue;
+            BatchJob job;
+            job.input = entry.path();
+            job.output = outputFor(fs::relative(entry.path(), source));
+            job.reference = referenceFor(fs::relative(entry.path(), source));
+            jobs.push_back(job);
+        }
+    } else {
+        std::ifstream list(source);
+        std::string line;
+        while (std::getline(list, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty()) continue;
+            BatchJob job;
+            job.input = line;
+            job.output = outputFor(job.input.filename());
+            job.reference = referenceFor(job.input.filename());
+            jobs.push_back(job);
+        }
+    }
+    for (BatchJob &job : jobs) {
+        std::error_code error;
+        job.inputBytes = fs::file_size(job.input, error);
+        if (error) job.inputBytes = 0;
+    }
+    return jobs;
+}
+
+// Encode, decode or verify every file of a directory or list in one process, options.jobs files at a time. The
+// largest files are started first so that a long one does not end up running alone at the end. A file that fails
+// is reported and skipped, the others still run. Returns 1 when any file failed.
+int runBatch(const std::string &source, const std::string &operation, const std::string &compression_type,
+             int bitrate, int predictor_degree, const CodecOptions &options) {
+    const bool encoding = operation == "encode";
+    const bool verifying = operation == "verify";
+    if (!std::filesystem::exists(source)) {
+        std::cerr << "Batch input not found: " << source << std::endl;
+        return 1;
+    }
+    std::vector<BatchJob> jobs = listBatchJobs(source, operation, options);
+    std::stable_sort(jobs.begin(), jobs.end(),
+                     [](const BatchJob &a, const BatchJob &b) { return a.inputBytes > b.inputBytes; });
+
+    std::mutex reportMutex;
+    const auto start = std::chrono::steady_clock::now();
+    parallelFor(jobs.size(), options.jobs, [&](size_t i) {
+        BatchJob &job = jobs[i];
+        CodecOptions fileOptions = options;
+        fileOptions.output_path = job.output.string();
+        fileOptions.reference_path = job.reference.string();
+        fileOptions.quiet = true;
+        fileOptions.stats_path.clear();  // Concurrent files would all write the same report
+        std::string failure;
+        try {
+            int status;
+            if (verifying) {
+                status = verify(job.input.string(), fileOptions);
+            } else {
+                std::filesystem::create_directories(job.output.parent_path());
+                status = encoding
+                             ? encode(job.input.string(), compression_type, bitrate, predictor_degree, fileOptions)
+                             : decode(job.input.string(), fileOptions);
+            }
+            if (status != 0) failure = "exit status " + std::to_string(status);
+        } catch (const std::exception &e) {
+            failure = e.what();
+        }
+        std::error_code error;
+        if (failure.empty() && !verifying) {
+            job.outputBytes = std::filesystem::file_size(job.output, error);
+            if (error) failure = "no output written";
+        }
+        job.ok = failure.empty();
+        if (!job.ok) {
+            std::lock_guard<std::mutex> lock(reportMutex);
+            std::cerr << "Failed: " << job.input.string() << " (" << failure << ")" << std::endl;
+        }
+    });
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t succeeded = 0;
+    uintmax_t inputBytes = 0, outputBytes = 0;
+    for (const BatchJob &job : jobs) {
+        if (!job.ok) continue;
+        succeeded++;
+        inputBytes += job.inputBytes;
+        outputBytes += job.outputBytes;
+    }
+    const double megabytes = inputBytes / 1e6;
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "Files: " << jobs.size() << ", " << succeeded << " "
+              << (encoding ? "encoded" : verifying ? "verified" : "decoded") << ", " << jobs.size() - succeeded
+              << " failed\n";
+    std::cout << "Input: " << megabytes << " MB";
+    if (!verifying) std::cout << ", output: " << outputBytes / 1e6 << " MB";
+    if (encoding && outputBytes > 0) std::cout << ", compression ratio: " << (double)inputBytes / outputBytes;
+    std::cout << '\n';
+    std::cout << "Time: " << seconds << " s, throughput: " << (seconds > 0 ? megabytes / seconds : 0)
+              << " MB/s of input" << std::endl;
+    return succeeded == jobs.size() ? 0 : 1;
+}
+
+#endif
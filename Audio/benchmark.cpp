@@ -0,0 +1,321 @@
+// Speed, ratio and quality benchmark of the codec, run through the in-memory AudioEncoder/AudioDecoder so file
+// I/O does not blur the timings. Every WAV file of a directory and a few synthetic signals go through each mode,
+// and the results are printed as a table and optionally saved as JSON.
+//
+//   benchmark [wav_directory] [--json <path>] [--repeat <count>] [--quick]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "./decoder.h"
+#include "./encoder.h"
+
+// One input signal, interleaved PCM in its container
+struct BenchmarkInput {
+    std::string name;
+    unsigned int channels = 2;
+    unsigned int sampleRate = 44100;
+    int bitsPerSample = 16;
+    std::vector<unsigned char> pcm;
+
+    size_t sampleCount() const { return pcm.size() / pcmBytes(bitsPerSample); }
+};
+
+// One way of encoding
+struct BenchmarkMode {
+    std::string name;
+    bool lossy = false;
+    int bitrate = 0;
+    int taylor_degree = -1;
+    CodecOptions options;
+};
+
+struct BenchmarkResult {
+    std::string input, mode;
+    double encodeSeconds = 0, decodeSeconds = 0;
+    size_t pcmBytes = 0, encodedBytes = 0, samples = 0;
+    double snr = 0;  // dB, infinite when lossless
+    bool exact = false;
+    size_t encodeHeapKb = 0, decodeHeapKb = 0;  // Peak heap taken by the encoder and decoder, output included
+};
+
+// Heap accounting: the global operator new and delete are replaced to keep the bytes in use and their high-water
+// mark, so every mode gets the memory it actually held. The process resident set cannot tell, it only grows and
+// already holds every input before the first run.
+std::atomic<size_t> heapBytes(0), heapPeak(0);
+const size_t HEAP_HEADER = alignof(std::max_align_t);  // Holds the size of each block
+
+void *operator new(size_t size) {
+    void *block = std::malloc(size + HEAP_HEADER);
+    if (!block) throw std::bad_alloc();
+    *static_cast<size_t *>(block) = size;
+    const size_t inUse = heapBytes += size;
+    size_t peak = heapPeak;
+    while (inUse > peak && !heapPeak.compare_exchange_weak(peak, inUse)) {
+    }
+    return static_cast<char *>(block) + HEAP_HEADER;
+}
+
+void operator delete(void *pointer) noexcept {
+    if (!pointer) return;
+    void *block = static_cast<char *>(pointer) - HEAP_HEADER;
+    heapBytes -= *static_cast<size_t *>(block);
+    std::free(block);
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete[](void *pointer) noexcept { operator delete(pointer); }
+void operator delete(void *pointer, size_t) noexcept { operator delete(pointer); }
+void operator delete[](void *pointer, size_t) noexcept { operator delete(pointer); }
+
+// Start measuring the heap taken from now on, returned in KB by heapTakenKb
+size_t startHeapMeasure() {
+    heapPeak = heapBytes.load();
+    return heapBytes;
+}
+
+size_t heapTakenKb(size_t start) { return (heapPeak - start + 1023) / 1024; }
+
+// Stereo 16-bit synthetic signal of the given length, sample(i, channel) in [-1, 1]
+template <typename Signal>
+BenchmarkInput synthetic(const std::string &name, double seconds, Signal sample) {
+    BenchmarkInput input;
+    input.name = name;
+    const size_t frames = (size_t)(seconds * input.sampleRate);
+    input.pcm.resize(frames * input.channels * 2);
+    for (size_t i = 0; i < frames; i++) {
+        for (unsigned int c = 0; c < input.channels; c++) {
+            const double value = std::max(-1.0, std::min(1.0, sample(i, c)));
+            PcmFormat<16>::store(&input.pcm[(i * input.channels + c) * 2], (int32_t)std::lround(value * 32767));
+        }
+    }
+    return input;
+}
+
+std::vector<BenchmarkInput> syntheticInputs(double seconds) {
+    const double rate = 44100;
+    std::vector<BenchmarkInput> inputs;
+    inputs.push_back(synthetic("sine", seconds, [&](size_t i, unsigned int c) {
+        return 0.5 * std::sin(2 * M_PI * (c ? 660 : 440) * i / rate);
+    }));
+    uint32_t state = 12345;  // Fixed LCG, the noise is the same on every run
+    inputs.push_back(synthetic("noise", seconds, [&](size_t, unsigned int) {
+        state = state * 1664525 + 1013904223;
+        return 0.25 * ((double)state / 4294967296.0 * 2 - 1);
+    }));
+    inputs.push_back(synthetic("silence", seconds, [](size_t, unsigned int) { return 0.0; }));
+    inputs.push_back(synthetic("chirp", seconds, [&](size_t i, unsigned int) {
+        // Exponential sweep from 20 Hz to 20 kHz
+        const double t = i / rate, k = std::log(1000.0) / seconds;
+        return 0.5 * std::sin(2 * M_PI * 20 * (std::exp(k * t) - 1) / k);
+    }));
+    return inputs;
+}
+
+bool loadWav(const std::filesystem::path &path, BenchmarkInput &input) {
+    WavReader wav;
+    if (!wav.open(path.string())) return false;
+    input.name = path.stem().string();
+    input.channels = wav.getChannelCount();
+    input.sampleRate = wav.getSampleRate();
+    input.bitsPerSample = wav.getBitsPerSample();
+    const PcmSpan samples = wav.samples();
+    input.pcm.assign(samples.data(), samples.data() + samples.size() * samples.bytesPerSample());
+    return true;
+}
+
+std::vector<BenchmarkMode> benchmarkModes(bool quick) {
+    std::vector<BenchmarkMode> modes;
+    auto add = [&](const std::string &name, bool lossy, int bitrate, int degree, CodecOptions options) {
+        BenchmarkMode mode;
+        mode.name = name;
+        mode.lossy = lossy;
+        mode.bitrate = bitrate;
+        mode.taylor_degree = degree;
+        mode.options = options;
+        modes.push_back(mode);
+    };
+    CodecOptions options;
+    add("lossless", false, 0, -1, options);
+    if (quick) return modes;
+    for (int degree : {1, 2, 3}) add("lossless-taylor" + std::to_string(degree), false, 0, degree, options);
+    options.search_effort = 1;
+    add("lossless-effort1", false, 0, -1, options);
+    options = CodecOptions();
+    options.block_effort = 3;
+    add("lossless-blocks3", false, 0, -1, options);
+    options = CodecOptions();
+    options.high_compression = true;
+    add("lossless-high", false, 0, -1, options);
+    add("lossy-50", true, 50, -1, CodecOptions());  // Below what most inputs can reach, the quality limit takes over
+    add("lossy-300", true, 300, -1, CodecOptions());
+    add("lossy-700", true, 700, -1, CodecOptions());
+    return modes;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+BenchmarkResult run(const BenchmarkInput &input, const BenchmarkMode &mode, int repeat) {
+    BenchmarkResult result;
+    result.input = input.name;
+    result.mode = mode.name;
+    result.pcmBytes = input.pcm.size();
+    result.samples = input.sampleCount();
+    result.encodeSeconds = result.decodeSeconds = std::numeric_limits<double>::infinity();
+
+    const int bytesPerSample = pcmBytes(input.bitsPerSample);
+    std::string encoded;
+    std::vector<unsigned char> decoded;
+    for (int r = 0; r < repeat; r++) {
+        size_t heap = startHeapMeasure();
+        auto start = std::chrono::steady_clock::now();
+        AudioEncoder encoder(input.channels, input.sampleRate, input.bitsPerSample, mode.lossy, mode.bitrate,
+                             mode.taylor_degree, mode.options, input.sampleCount());
+        encoder.pushSamples(PcmSpan(input.pcm.data(), input.sampleCount(), bytesPerSample));
+        encoder.finish();
+        encoded = encoder.pullBytes();
+        result.encodeSeconds = std::min(result.encodeSeconds, secondsSince(start));
+        result.encodeHeapKb = heapTakenKb(heap);
+
+        heap = startHeapMeasure();
+        start = std::chrono::steady_clock::now();
+        AudioDecoder decoder;
+        decoder.pushBytes(encoded.data(), encoded.size());
+        decoded = decoder.pullSamples();
+        result.decodeSeconds = std::min(result.decodeSeconds, secondsSince(start));
+        result.decodeHeapKb = heapTakenKb(heap);
+    }
+    result.encodedBytes = encoded.size();
+    result.exact = decoded == input.pcm;
+
+    double signal = 0, noise = 0;
+    const size_t n = std::min(decoded.size(), input.pcm.size()) / bytesPerSample;
+    for (size_t i = 0; i < n; i++) {
+        const double x = pcmValue(&input.pcm[i * bytesPerSample], input.bitsPerSample);
+        const double error = x - pcmValue(&decoded[i * bytesPerSample], input.bitsPerSample);
+        signal += x * x;
+        noise += error * error;
+    }
+    result.snr = noise == 0 ? std::numeric_limits<double>::infinity() : 10 * std::log10(signal / noise);
+    return result;
+}
+
+double compressionRatio(const BenchmarkResult &r) { return r.encodedBytes ? (double)r.pcmBytes / r.encodedBytes : 0; }
+double megabytesPerSecond(size_t bytes, double seconds) { return seconds > 0 ? bytes / 1e6 / seconds : 0; }
+
+void printTable(const std::vector<BenchmarkResult> &results) {
+    std::cout << std::left << std::setw(14) << "input" << std::setw(18) << "mode" << std::right << std::setw(8)
+              << "ratio" << std::setw(10) << "enc MB/s" << std::setw(10) << "dec MB/s" << std::setw(12)
+              << "enc Msmp/s" << std::setw(9) << "SNR dB" << std::setw(7) << "exact" << std::setw(12) << "enc heap KB"
+              << std::setw(12) << "dec heap KB" << '\n';
+    std::cout << std::fixed;
+    for (const BenchmarkResult &r : results) {
+        std::cout << std::left << std::setw(14) << r.input << std::setw(18) << r.mode << std::right
+                  << std::setprecision(3) << std::setw(8) << compressionRatio(r) << std::setprecision(2) << std::setw(10)
+                  << megabytesPerSecond(r.pcmBytes, r.encodeSeconds) << std::setw(10)
+                  << megabytesPerSecond(r.pcmBytes, r.decodeSeconds) << std::setw(12)
+                  << r.samples / 1e6 / r.encodeSeconds << std::setw(9);
+        if (std::isinf(r.snr)) {
+            std::cout << "inf";
+        } else {
+            std::cout << r.snr;
+        }
+        std::cout << std::setw(7) << (r.exact ? "yes" : "no") << std::setw(12) << r.encodeHeapKb << std::setw(12)
+                  << r.decodeHeapKb << '\n';
+    }
+}
+
+void writeJson(const std::string &path, const std::vector<BenchmarkResult> &results) {
+    std::ofstream json(path);
+    json << std::setprecision(6) << "[\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchmarkResult &r = results[i];
+        json << "  {\"input\": \"" << r.input << "\", \"mode\": \"" << r.mode << "\", \"pcm_bytes\": " << r.pcmBytes
+             << ", \"encoded_bytes\": " << r.encodedBytes << ", \"ratio\": " << compressionRatio(r)
+             << ", \"encode_seconds\": " << r.encodeSeconds << ", \"decode_seconds\": " << r.decodeSeconds
+             << ", \"encode_mb_per_s\": " << megabytesPerSecond(r.pcmBytes, r.encodeSeconds)
+             << ", \"decode_mb_per_s\": " << megabytesPerSecond(r.pcmBytes, r.decodeSeconds)
+             << ", \"encode_samples_per_s\": " << r.samples / r.encodeSeconds
+             << ", \"decode_samples_per_s\": " << r.samples / r.decodeSeconds << ", \"snr_db\": ";
+        if (std::isinf(r.snr)) {
+            json << "null";  // Lossless, JSON has no infinity
+        } else {
+            json << r.snr;
+        }
+        json << ", \"exact\": " << (r.exact ? "true" : "false") << ", \"encode_heap_kb\": " << r.encodeHeapKb
+             << ", \"decode_heap_kb\": " << r.decodeHeapKb << "}"
+             << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    json << "]\n";
+}
+
+int main(int argc, char *argv[]) {
+    std::string directory = "./datasets", jsonPath;
+    int repeat = 1;
+    bool quick = false;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--json" && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            repeat = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--quick") {
+            quick = true;
+        } else if (arg.rfind("--", 0) != 0) {
+            directory = arg;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [wav_directory] [--json <path>] [--repeat <count>] [--quick]\n";
+            return 1;
+        }
+    }
+
+    std::vector<BenchmarkInput> inputs;
+    if (std::filesystem::is_directory(directory)) {
+        std::vector<std::filesystem::path> files;
+        for (const auto &entry : std::filesystem::directory_iterator(directory)) {
+            if (entry.is_regular_file() && entry.path().extension() == ".wav") files.push_back(entry.path());
+        }
+        std::sort(files.begin(), files.end());
+        for (const auto &file : files) {
+            BenchmarkInput input;
+            if (loadWav(file, input)) {
+                inputs.push_back(std::move(input));
+            } else {
+                std::cerr << "Skipping " << file.string() << std::endl;
+            }
+        }
+    } else {
+        std::cerr << "No directory " << directory << ", synthetic signals only" << std::endl;
+    }
+    for (BenchmarkInput &input : syntheticInputs(quick ? 2 : 10)) inputs.push_back(std::move(input));
+
+    std::vector<BenchmarkResult> results;
+    for (const BenchmarkMode &mode : benchmarkModes(quick)) {
+        for (const BenchmarkInput &input : inputs) results.push_back(run(input, mode, repeat));
+    }
+    printTable(results);
+    if (!jsonPath.empty()) writeJson(jsonPath, results);
+
+    // A lossless mode that does not round-trip, or a lossy one decoding to more noise than signal, is a failure, not
+    // a data point
+    for (const BenchmarkResult &r : results) {
+        if (r.mode.rfind("lossless", 0) == 0 && !r.exact) return 1;
+        if (r.mode.rfind("lossy", 0) == 0 && !(r.snr > 0)) return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,136 @@
+#ifndef BLOCKSIZE
+#define BLOCKSIZE
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../Common/bitStream.h"
+#include "./audio_utilities.h"
+#include "./stereo.h"
+
+// Frame (block) sizes, counted in samples per channel. Standard sizes are powers of two from 256 to 8192 and take
+// a 3-bit code in the frame header. Any other size (the end of the input) is written out in full.
+const int MIN_BLOCK_SIZE = 256;
+const int MAX_BLOCK_SIZE = 8192;
+const int BLOCK_CODE_BITS = 3;
+const int BLOCK_CODE_EXPLICIT = 7;
+const int EXPLICIT_BLOCK_BITS = 24;  // Interleaved samples of an odd-sized frame
+const int MAX_BLOCK_EFFORT = 5;      // Halvings tried below MAX_BLOCK_SIZE, 5 reaches MIN_BLOCK_SIZE
+
+// Write the size of a frame of frameSize interleaved samples
+void writeBlockSize(BitStream &stream, int frameSize, int channelCount) {
+    for (int code = 0; (MIN_BLOCK_SIZE << code) <= MAX_BLOCK_SIZE; code++) {
+        if (frameSize == (MIN_BLOCK_SIZE << code) * channelCount) {
+            stream.writeBits(code, BLOCK_CODE_BITS);
+            return;
+        }
+    }
+    stream.writeBits(BLOCK_CODE_EXPLICIT, BLOCK_CODE_BITS);
+    stream.writeBits(frameSize, EXPLICIT_BLOCK_BITS);
+}
+
+// Bits writeBlockSize takes for a frame of frameSize interleaved samples
+int blockSizeBits(int frameSize, int channelCount) {
+    for (int code = 0; (MIN_BLOCK_SIZE << code) <= MAX_BLOCK_SIZE; code++) {
+        if (frameSize == (MIN_BLOCK_SIZE << code) * channelCount) return BLOCK_CODE_BITS;
+    }
+    return BLOCK_CODE_BITS + EXPLICIT_BLOCK_BITS;
+}
+
+// Read the size of a frame back, in interleaved samples. Codes of no standard size, and sizes of 0 or beyond
+// maxFrameSize (the largest frame the stream header allows), throw std::runtime_error: a damaged stream must not
+// make the decoder write past its frame buffers.
+int readBlockSize(BitStream &stream, int channelCount, size_t maxFrameSize) {
+    const int code = stream.readBits(BLOCK_CODE_BITS);
+    size_t frameSize;
+    if (code == BLOCK_CODE_EXPLICIT) {
+        frameSize = stream.readBits(EXPLICIT_BLOCK_BITS);
+    } else if ((MIN_BLOCK_SIZE << code) > MAX_BLOCK_SIZE) {
+        throw std::runtime_error("Invalid block size code " + std::to_string(code));
+    } else {
+        frameSize = (size_t)(MIN_BLOCK_SIZE << code) * channelCount;
+    }
+    if (frameSize == 0 || frameSize > maxFrameSize) {
+        throw std::runtime_error("Frame of " + std::to_string(frameSize) + " samples out of range");
+    }
+    return frameSize;
+}
+
+// Side information a frame costs regardless of its length: length prefix, frame header and, per channel, the
+// predictor and residual partitioning (a typical LPC channel, around 24 coefficients)
+const int FRAME_OVERHEAD_BITS = 32 + 16;
+const int CHANNEL_OVERHEAD_BITS = 320;
+
+// Chooses block sizes over a window of MAX_BLOCK_SIZE samples per channel. A block is halved whenever the
+// estimated residual bits of its halves (from the same cheap fixed-predictor estimate the stereo decision uses)
+// plus one more frame of side information come out below its own, so stationary passages keep long frames and
+// transients get short ones. effort bounds the number of halvings, each one being a pass over the window.
+class BlockSplitter {
+   private:
+    const std::vector<std::vector<int32_t>> &channels;
+    std::vector<int32_t> mid, side;  // Stereo candidates, the estimate takes the cheapest pairing
+    int minBlock;
+
+    double estimateBits(int start, int n) const {
+        if (channels.size() == 2) {
+            const double left = estimatedChannelBits(fixedResidualSum(channels[0].data() + start, n), n);
+            const double right = estimatedChannelBits(fixedResidualSum(channels[1].data() + start, n), n);
+            const double m = estimatedChannelBits(fixedResidualSum(mid.data() + start, n), n);
+            const double s = estimatedChannelBits(fixedResidualSum(side.data() + start, n), n);
+            return std::min({left + right, left + s, s + right, m + s});
+        }
+        double bits = 0;
+        for (const auto &channel : channels) bits += estimatedChannelBits(fixedResidualSum(channel.data() + start, n), n);
+        return bits;
+    }
+
+    double overheadBits() const { return FRAME_OVERHEAD_BITS + CHANNEL_OVERHEAD_BITS * channels.size(); }
+
+    // Cheapest split of [start, start + n) into blocks, appended to blocks, evaluated bottom-up over the halving
+    // tree. Returns its estimated bits.
+    double split(int start, int n, double wholeBits, std::vector<int> &blocks) const {
+        const int half = n / 2;
+        if (half < minBlock) {
+            blocks.push_back(n);
+            return wholeBits;
+        }
+        std::vector<int> halves;
+        double bits = split(start, half, estimateBits(start, half) + overheadBits(), halves) +
+                      split(start + half, half, estimateBits(start + half, half) + overheadBits(), halves);
+        if (bits >= wholeBits) {
+            blocks.push_back(n);
+            return wholeBits;
+        }
+        blocks.insert(blocks.end(), halves.begin(), halves.end());
+        return bits;
+    }
+
+   public:
+    BlockSplitter(const std::vector<std::vector<int32_t>> &channels, int effort)
+        : channels(channels), minBlock(std::max(MIN_BLOCK_SIZE, MAX_BLOCK_SIZE >> effort)) {
+        if (channels.size() == 2) {
+            const int n = std::min(channels[0].size(), channels[1].size());
+            mid.resize(n);
+            side.resize(n);
+            const int32_t *l = channels[0].data();
+            const int32_t *r = channels[1].data();
+#pragma omp simd
+            for (int i = 0; i < n; i++) {
+                mid[i] = (l[i] + r[i]) >> 1;
+                side[i] = l[i] - r[i];
+            }
+        }
+    }
+
+    // Block lengths (samples per channel) covering a full window, in order
+    std::vector<int> blocks() const {
+        std::vector<int> result;
+        split(0, MAX_BLOCK_SIZE, estimateBits(0, MAX_BLOCK_SIZE) + overheadBits(), result);
+        return result;
+    }
+};
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef CORRECTION
+#define CORRECTION
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../Common/bitStream.h"
+#include "./audio_utilities.h"
+#include "./rice.h"
+
+// Hybrid lossy coding keeps what quantization took away from a lossy stream in a sidecar correction stream. It
+// holds, for every frame of the lossy stream and in the same order, the difference between the source PCM and the
+// frame's exact lossy decoding, so the lossy stream decodes on its own as before and adding the correction makes it
+// lossless. The correction stream starts with the channel count and sample size of the lossy stream, then its
+// frames follow as length-prefixed blocks ended like the lossy frame list (see writeEndOfFrames). A frame starts with
+// a flag set when it needs no correction (q_bits 0), otherwise each channel's differences follow, either as
+// partitioned Rice codes or, behind a flag, stored around the center of their range. Quantization leaves nearly
+// uniform differences over 2^q_bits values, which fixed-width fields hold a bit or more per sample tighter.
+const bool CORRECTION_INTERLEAVING = true;  // Differences straddle zero, folding them beats a separate sign bit
+
+void writeCorrectionHeader(BitStream &stream, uint8_t channels, uint8_t bits_per_sample) {
+    stream.writeBits(channels, 4);
+    stream.writeBits(bits_per_sample - 1, 5);
+    stream.alignToByte();
+}
+
+void readCorrectionHeader(BitStream &stream, uint8_t &channels, uint8_t &bits_per_sample) {
+    channels = stream.readBits(4);
+    bits_per_sample = stream.readBits(5) + 1;
+    stream.alignToByte();
+}
+
+// Correction block of one frame coded with q_bits: source holds the frame's input and decoded its lossy decoding
+std::string correctionFrame(PcmSpan source, const unsigned char *decoded, int q_bits, int channelCount,
+                            int bitsPerSample) {
+    std::ostringstream block;
+    {
+        BitStream stream(block);
+        stream.writeBit(q_bits == 0);
+        if (q_bits > 0) {
+            withPcmFormat(bitsPerSample, [&](auto format) {
+                using Format = decltype(format);
+                const int width = Format::BITS / 8;
+                std::vector<int> differences, centered;
+                RicePartitioning partitioning;
+                for (int c = 0; c < channelCount; c++) {
+                    differences.resize(channelLength(source.size(), channelCount, c));
+                    for (size_t j = 0; j < differences.size(); j++) {
+                        const size_t offset = (j * channelCount + c) * width;
+                        differences[j] = Format::load(source.data() + offset) - Format::load(decoded + offset);
+                    }
+                    int32_t minimum, maximum;
+                    sampleRange(Span<const int32_t>(differences.data(), differences.size()), minimum, maximum);
+                    const int32_t center = minimum + (maximum - minimum) / 2;
+                    centered.resize(differences.size());
+                    for (size_t j = 0; j < differences.size(); j++) centered[j] = differences[j] - center;
+                    const Span<const int32_t> stored(centered.data(), centered.size());
+                    const uint64_t storedBits =
+                        storedSampleBits(Span<const int32_t>(&center, 1)) + storedSampleBits(stored);
+
+                    const uint64_t riceBits = choosePartitioning(differences, CORRECTION_INTERLEAVING, partitioning);
+                    const bool store = storedBits < riceBits;
+                    stream.writeBit(store);
+                    if (store) {
+                        writeStoredSamples(stream, Span<const int32_t>(&center, 1));
+                        writeStoredSamples(stream, stored);
+                    } else {
+                        writePartitionedResiduals(stream, differences, partitioning, CORRECTION_INTERLEAVING);
+                    }
+                }
+            });
+        }
+    }
+    return block.str();
+}
+
+// Add the correction of a frame (the block's bits, read from stream) to its decoded samples in output
+void applyCorrection(BitStream &stream, int channelCount, int bitsPerSample, int frameSize, unsigned char *output) {
+    if (stream.readBit()) return;
+    withPcmFormat(bitsPerSample, [&](auto format) {
+        using Format = decltype(format);
+        const int width = Format::BITS / 8;
+        std::vector<int32_t> stored;
+        for (int c = 0; c < channelCount; c++) {
+            const size_t n = channelLength(frameSize, channelCount, c);
+            size_t j = 0;
+            auto add = [&](int32_t difference) {
+                unsigned char *sample = output + (j++ * channelCount + c) * width;
+                Format::store(sample, Format::load(sample) + difference);
+            };
+            if (stream.readBit()) {
+                int32_t center;
+                readStoredSamples(stream, &center, 1);
+                stored.resize(n);
+                readStoredSamples(stream, stored.data(), n);
+                for (int32_t difference : stored) add(center + difference);
+            } else {
+                readPartitionedResiduals(stream, n, CORRECTION_INTERLEAVING, add);
+            }
+        }
+    });
+}
+
+#endif
@@ -1,69 +1,462 @@
+#ifndef DECODER
+#define DECODER
+
 #include <cmath>
 #include <filesystem>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <memory>
 #include <numeric>
+#include <sstream>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
+#include "../Common/crc32c.h"
 #include "../Common/golomb.h"
-#include "./SFML-2.6.2/include/SFML/Audio.hpp"
 #include "./audio_utilities.h"
+#include "./lpc.h"
+#include "./blocksize.h"
+#include "./correction.h"
+#include "./nlms.h"
+#include "./rice.h"
+#include "./stereo.h"
+#include "./wide.h"
+
+// Reconstruct the samples of a channel from its warm-up samples and residuals through the channel's fixed
+// predictor, and the adaptive cascade when the file uses it
+template <typename Filter>
+void reconstructChannel(BitStream &stream, bool useInterleaving, Filter &filter, NlmsCascade *cascade, int q_bits,
+                        std::vector<int32_t> &output) {
+    const size_t warmup = std::min(output.size(), (size_t)filter.warmupLength());
+    readWarmup(stream, output.data(), warmup);
+    size_t i = pushWarmup(filter, Span<const int32_t>(output.data(), warmup));
+    readPartitionedResiduals(stream, output.size() - warmup, useInterleaving, [&](int residual) {
+        int32_t predicted = filter.predict();
+        residual = residual << q_bits;
+        if (cascade) {
+            cascade->predict();
+            residual = cascade->update(residual);
+        }
+        output[i++] = filter.push(predicted, residual);
+    });
+}
+
+// Decode one channel of a frame into output (already sized to the channel's length), whose samples have
+// sampleBits significant bits
+void decodeChannel(BitStream &stream, int q_bits, bool useInterleaving, bool useNlms, int sampleBits,
+                   std::vector<int32_t> &output) {
+    // Read channel header
+    int predictor_type = stream.readBits(PREDICTOR_TYPE_BITS);
+    if (predictor_type == PREDICTOR_CONSTANT) {
+        int32_t constant;
+        readStoredSamples(stream, &constant, 1);
+        std::fill(output.begin(), output.end(), constant);
+        return;
+    }
+    if (predictor_type == PREDICTOR_VERBATIM) {
+        readStoredSamples(stream, output.data(), output.size());
+        return;
+    }
+    int taylor_degree = 0;
+    LpcParameters lpc;
+    if (predictor_type == PREDICTOR_LPC) {
+        readLpcParameters(stream, lpc);
+    } else {
+        taylor_degree = stream.readBits(3); // Read taylor degree used
+    }
+
+    std::unique_ptr<NlmsCascade> cascade(useNlms ? new NlmsCascade(sampleBits) : nullptr);
+    if (predictor_type == PREDICTOR_LPC) {
+        LpcFilter filter(lpc, output.size());
+        reconstructChannel(stream, useInterleaving, filter, cascade.get(), q_bits, output);
+    } else {
+        TaylorFilter filter(taylor_degree, output.size());
+        reconstructChannel(stream, useInterleaving, filter, cascade.get(), q_bits, output);
+    }
+}
+
+// Decode one frame from the stream, writing its reconstructed interleaved samples to output in the file's PCM
+// format (room for maxFrameSize samples, the largest frame of the file). Returns the number of samples in the
+// frame, and its q_bits in frameQBits when given. Frames larger than maxFrameSize throw std::runtime_error.
+int decodeFrame(BitStream &stream, int channelCount, int bitsPerSample, bool useInterleaving, bool useNlms,
+                unsigned char *output, size_t maxFrameSize, int *frameQBits = nullptr) {
+    if (isWidePcm(bitsPerSample)) {
+        std::vector<unsigned char> core(maxFrameSize * 3);
+        const int currentFrameSize = decodeFrame(stream, channelCount, WIDE_CORE_BITS, useInterleaving, useNlms,
+                                                 core.data(), maxFrameSize, frameQBits);
+        joinWideFrame(stream, bitsPerSample, PcmSpan(core.data(), currentFrameSize, 3), output);
+        return currentFrameSize;
+    }
+    // Read frame header
+    int currentFrameSize = readBlockSize(stream, channelCount, maxFrameSize);
+    int q_bits = stream.readBits(4);        // Read quantization factor
+    if (frameQBits) *frameQBits = q_bits;
+    int shift = stream.readBit() ? stream.readBits(WASTED_SHIFT_BITS) : 0;  // Wasted bits, applied after q_bits
+    StereoMode stereo_mode = channelCount == 2 ? (StereoMode)stream.readBits(STEREO_MODE_BITS) : STEREO_INDEPENDENT;
+
+    // cout << " Q_bits: " << q_bits << endl;
+
+    // Channels are stored one after the other, interleaved again once all of them are decoded
+    std::vector<std::vector<int32_t>> channels(channelCount);
+    for (int c = 0; c < channelCount; c++) {
+        channels[c].resize(channelLength(currentFrameSize, channelCount, c));
+        decodeChannel(stream, q_bits, useInterleaving, useNlms, bitsPerSample - shift, channels[c]);
+    }
+    if (channelCount == 2) undoStereoMode(stereo_mode, channels[0], channels[1]);
+    withPcmFormat(bitsPerSample, [&](auto format) { interleave<decltype(format)>(channels, output, shift); });
+    return currentFrameSize;
+}
+
+// Streaming counterpart of AudioEncoder, with no filesystem side effects: .g7a bytes go in through pushBytes in
+// chunks of any size and the decoded interleaved samples come out through pullSamples, each frame as soon as all of
+// its bytes have arrived. The format getters are valid once hasHeader() is true. Streams this decoder cannot read
+// throw std::runtime_error.
+class AudioDecoder {
+   private:
+    std::string input;    // Bytes received and not consumed yet
+    size_t position = 0;  // Start of the unconsumed bytes in input
+    bool headerRead = false;
+    bool ended = false;
+    uint8_t channelCount = 0;
+    uint32_t samplingFreq = 0;
+    uint8_t bitsPerSample = 16;
+    uint16_t frame_size = 0;
+    uint32_t totalSamples = STREAMING_LENGTH;
+    uint32_t checksum = 0;
+    bool useInterleaving = false;
+    bool useNlms = false;
+    bool lossy = false;
+    std::vector<unsigned char> output;  // Decoded PCM not pulled yet
+
+    static const size_t HEADER_BYTES = 12;  // writeHeader's 92 bits, byte aligned
 
-int decode(std::string file_path) {
+    size_t available() const { return input.size() - position; }
+
+    // Frame lengths and the sample count are written most significant byte first
+    uint32_t peek32(size_t offset) const {
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(input.data()) + position + offset;
+        return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+    }
+
+    // Decode the header and every frame that is complete
+    void decodeAvailable() {
+        if (!headerRead) {
+            if (available() < HEADER_BYTES) return;
+            std::istringstream header(input.substr(position, HEADER_BYTES));
+            BitStream headerStream(header);
+            readHeader(headerStream, channelCount, samplingFreq, bitsPerSample, frame_size, totalSamples,
+                       useInterleaving, useNlms);
+            if (!isSupportedBitDepth(bitsPerSample)) throw std::runtime_error("Unsupported sample size");
+            position += HEADER_BYTES;
+            headerRead = true;
+        }
+        const int bytesPerSample = pcmBytes(bitsPerSample);
+        while (!ended && available() >= FRAME_LENGTH_BITS / 8) {
+            const uint32_t frameBytes = peek32(0);
+            if (frameBytes == 0) {
+                if (available() < FRAME_LENGTH_BITS / 8 + 8) break;
+                totalSamples = peek32(FRAME_LENGTH_BITS / 8);
+                checksum = peek32(FRAME_LENGTH_BITS / 8 + 4);
+                position += FRAME_LENGTH_BITS / 8 + 8;
+                ended = true;
+                break;
+            }
+            if (available() < FRAME_LENGTH_BITS / 8 + (size_t)frameBytes) break;
+
+            // Frames decode straight into the output, which is trimmed to the frame's actual length
+            std::istringstream frame(input.substr(position + FRAME_LENGTH_BITS / 8, frameBytes));
+            BitStream frameStream(frame);
+            const size_t start = output.size();
+            const size_t maxFrameSize = (size_t)frame_size * channelCount;
+            output.resize(start + maxFrameSize * bytesPerSample);
+            int q_bits;
+            const int currentFrameSize = decodeFrame(frameStream, channelCount, bitsPerSample, useInterleaving,
+                                                     useNlms, &output[start], maxFrameSize, &q_bits);
+            lossy = lossy || q_bits > 0;
+            output.resize(start + (size_t)currentFrameSize * bytesPerSample);
+            position += FRAME_LENGTH_BITS / 8 + frameBytes;
+        }
+        input.erase(0, position);
+        position = 0;
+    }
+
+   public:
+    // Append encoded bytes and decode every frame they complete
+    void pushBytes(const void *data, size_t size) {
+        input.append(static_cast<const char *>(data), size);
+        decodeAvailable();
+    }
+
+    // Interleaved samples decoded since the last call, in the stream's PCM format (little-endian, 8-bit unsigned)
+    std::vector<unsigned char> pullSamples() {
+        std::vector<unsigned char> samples;
+        samples.swap(output);
+        return samples;
+    }
+
+    // Interleaved samples decoded since the last call, for 16-bit streams
+    std::vector<int16_t> pullSamples16() {
+        if (headerRead && bitsPerSample != 16) throw std::logic_error("Not a 16-bit stream");
+        std::vector<int16_t> samples(output.size() / 2);
+        for (size_t i = 0; i < samples.size(); i++) samples[i] = PcmFormat<16>::load(&output[i * 2]);
+        output.clear();
+        return samples;
+    }
+
+    bool hasHeader() const { return headerRead; }
+    // True once the end of the frames has been read, every sample is then available
+    bool isFinished() const { return ended; }
+    unsigned int getChannelCount() const { return channelCount; }
+    unsigned int getSampleRate() const { return samplingFreq; }
+    int getBitsPerSample() const { return bitsPerSample; }
+    // Interleaved samples in the stream, STREAMING_LENGTH until the end of a streamed file
+    uint32_t getSampleCount() const { return totalSamples; }
+    // CRC-32C of the source PCM, known once finished
+    uint32_t getChecksum() const { return checksum; }
+    // True when a frame decoded so far was quantized
+    bool isLossy() const { return lossy; }
+};
+
+// With a single thread frames are decoded in order and handed to the output as soon as they are ready,
+// so memory stays constant and the input may be a pipe ("-" for stdin). Otherwise they are located
+// through their length prefixes and decoded concurrently (threads == 0 uses every available core).
+// A hybrid correction stream (options.correction_path) is applied in order, on one thread.
+int decode(std::string file_path, const CodecOptions &options = CodecOptions()) {
     // Open input compressed file
-    BitStream stream(file_path, false);
+    const bool fromStdin = file_path == "-";
+    std::ifstream inputFile;
+    if (fromStdin) {
+        setBinaryMode(stdin);
+    } else {
+        inputFile.open(file_path, std::ios::in | std::ios::binary);
+        if (!inputFile.is_open()) {
+            std::cerr << "Failed to open encoded file: " << file_path << std::endl;
+            return 1;
+        }
+    }
+    BitStream stream(fromStdin ? std::cin : inputFile);
 
     // Read header information
     uint8_t channelCount;
-    uint16_t samplingFreq;
+    uint32_t samplingFreq;
+    uint8_t bitsPerSample;
     uint16_t frame_size;
     uint32_t totalSamples;
     bool useInterleaving;
+    bool useNlms;
+
+    readHeader(stream, channelCount, samplingFreq, bitsPerSample, frame_size, totalSamples, useInterleaving, useNlms);
+    stream.alignToByte();
+    if (!isSupportedBitDepth(bitsPerSample)) {
+        std::cerr << "Unsupported sample size: " << static_cast<int>(bitsPerSample) << " bits" << std::endl;
+        return 1;
+    }
+    const int bytesPerSample = pcmBytes(bitsPerSample);
+
+    // Open the output, decoded PCM on stdout means the information goes to stderr
+    std::string output_path = options.output_path;
+    if (output_path.empty()) {
+        std::string output_directory = "./outputs/wav_audio/";
+        std::filesystem::create_directories(output_directory);
+        output_path = output_directory + std::filesystem::path(fromStdin ? "stdin" : file_path).stem().string() +
+                      (options.raw_output ? "_decoded.raw" : "_decoded.wav");
+    }
+    std::ostream discard(nullptr);
+    std::ostream &info = options.quiet ? discard : output_path == "-" ? std::cerr : std::cout;
+
+    info << "Channel Count: " << static_cast<int>(channelCount) << '\n';
+    info << "Sampling Frequency: " << samplingFreq << " Hz\n";
+    info << "Sample Size: " << pcmFormatName(bitsPerSample) << "\n";
+    info << "Frame Size: " << frame_size << " samples per channel (at most)\n";
+    if (totalSamples == STREAMING_LENGTH) {
+        info << "Total Samples: unknown (streamed)\n";
+    } else {
+        info << "Total Samples: " << totalSamples << '\n';
+    }
+    info << "Use Interleaving: " << (useInterleaving ? "Yes" : "No") << '\n';
+    info << "High Compression: " << (useNlms ? "Yes" : "No") << '\n';
+
+    // A hybrid correction stream goes frame by frame along the lossy one
+    std::unique_ptr<BitStream> correction;
+    if (!options.correction_path.empty()) {
+        try {
+            correction.reset(new BitStream(options.correction_path, false));
+        } catch (const std::exception &) {
+            std::cerr << "Failed to open correction file: " << options.correction_path << std::endl;
+            return 1;
+        }
+        uint8_t correctionChannels, correctionBits;
+        readCorrectionHeader(*correction, correctionChannels, correctionBits);
+        if (correctionChannels != channelCount || correctionBits != bitsPerSample || isWidePcm(bitsPerSample)) {
+            std::cerr << "Correction file does not match the encoded file" << std::endl;
+            return 1;
+        }
+    }
+
+    SampleSink sink;
+    if (!sink.open(output_path, samplingFreq, channelCount, bitsPerSample, options.raw_output)) {
+        std::cerr << "Failed to open output file: " << output_path << std::endl;
+        return 1;
+    }
+
+    // Frame sizes are checked against the header, a damaged stream stops the decoding instead of overrunning the
+    // frame buffers
+    const size_t maxFrameSize = (size_t)frame_size * channelCount;
+    try {
+        if (options.threads == 1 || fromStdin || correction) {
+            // Iterate through frames, each one goes to the output before the next is read
+            std::vector<unsigned char> frameSamples(maxFrameSize * bytesPerSample);
+            for (uint32_t frameBytes = stream.readBits(FRAME_LENGTH_BITS); frameBytes != 0;
+                 frameBytes = stream.readBits(FRAME_LENGTH_BITS)) {
+                int currentFrameSize = decodeFrame(stream, channelCount, bitsPerSample, useInterleaving, useNlms,
+                                                   frameSamples.data(), maxFrameSize);
+                stream.alignToByte();
+                if (correction) {
+                    if (correction->readBits(FRAME_LENGTH_BITS) == 0) {
+                        std::cerr << "Correction file ends before the encoded file" << std::endl;
+                        return 1;
+                    }
+                    applyCorrection(*correction, channelCount, bitsPerSample, currentFrameSize, frameSamples.data());
+                    correction->alignToByte();
+                }
+                sink.write(frameSamples.data(), currentFrameSize);
+            }
+        } else {
+            // Build the frame index by hopping over the length prefixes, reading each frame's size on the way
+            std::vector<std::streampos> frameOffsets;
+            std::vector<size_t> frameStarts;  // First sample of each frame in the output
+            size_t nextStart = 0;
+            for (uint32_t frameBytes = stream.readBits(FRAME_LENGTH_BITS); frameBytes != 0;
+                 frameBytes = stream.readBits(FRAME_LENGTH_BITS)) {
+                frameOffsets.push_back(stream.tellByte());
+                frameStarts.push_back(nextStart);
+                nextStart += readBlockSize(stream, channelCount, maxFrameSize);
+                stream.seekByte(frameOffsets.back() + (std::streamoff)frameBytes);
+            }
+            totalSamples = stream.readBits(32);  // The source checksum that follows is left to verify
+            const size_t frameCount = frameOffsets.size();
 
-    readHeader(stream, channelCount, samplingFreq, frame_size, totalSamples, useInterleaving);
-
-    std::cout << "Channel Count: " << static_cast<int>(channelCount) << '\n';
-    std::cout << "Sampling Frequency: " << samplingFreq << " Hz\n";
-    std::cout << "Frame Size: " << frame_size << '\n';
-    std::cout << "Total Samples: " << totalSamples << '\n';
-    std::cout << "Use Interleaving: " << (useInterleaving ? "Yes" : "No") << '\n';
-
-    // Prepare output vector
-    std::vector<sf::Int16> globalSamples;
-    globalSamples.reserve(totalSamples);
-
-    // Iterate through frames
-    for (int frameStart = 0; frameStart < totalSamples; frameStart += frame_size) {
-        int currentFrameSize = std::min((int)frame_size, (int)(totalSamples - frameStart));
-        std::vector<sf::Int16> frameSamples;
-        frameSamples.reserve(currentFrameSize);
-
-        // Read frame header
-        int m = stream.readBits(16);            // Read Golomb m parameter
-        int q_bits = stream.readBits(4);        // Read quantization factor
-        int taylor_degree = stream.readBits(3); // Read taylor degree used
-
-        // cout << "Decoding frame starting at sample " << frameStart << " with size " << currentFrameSize << endl;
-        // cout << " Golomb M: " << m << " Q_bits: " << q_bits << endl;
-
-        // Initialize Golomb decoder
-        Golomb golomb(m, useInterleaving);
-        for (int i = 0; i < currentFrameSize; ++i) {
-            int residual = golomb.decode(stream);
-            residual = residual << q_bits;
-
-            // int predicted = predictor_basic(frameSamples);
-            int predicted = predictor_taylor(taylor_degree, channelCount, frameSamples);
-
-            sf::Int16 reconstructedSample = predicted + residual;
-            globalSamples.push_back(reconstructedSample);
-            frameSamples.push_back(reconstructedSample);
-            // cout << "Residual: " << residual << " Predicted: " << predicted << " Reconstructed Sample: " << reconstructedSample << endl;
+            // Prepare output vector, every frame writes straight into its own slot
+            const size_t outputSamples = std::max<size_t>(totalSamples, nextStart);
+            std::vector<unsigned char> globalSamples(outputSamples * bytesPerSample);
+
+            // Each task reads a run of frames through its own handle, so workers only share the output buffer
+            const size_t framesPerTask = 16;
+            parallelFor((frameCount + framesPerTask - 1) / framesPerTask, options.threads, [&](size_t task) {
+                BitStream frameStream(file_path, false);
+                size_t lastFrame = std::min(frameCount, (task + 1) * framesPerTask);
+                for (size_t frame = task * framesPerTask; frame < lastFrame; frame++) {
+                    const size_t frameEnd = frame + 1 < frameCount ? frameStarts[frame + 1] : nextStart;
+                    frameStream.seekByte(frameOffsets[frame]);
+                    decodeFrame(frameStream, channelCount, bitsPerSample, useInterleaving, useNlms,
+                                &globalSamples[frameStarts[frame] * bytesPerSample], frameEnd - frameStarts[frame]);
+                }
+            });
+            sink.write(globalSamples.data(), outputSamples);
         }
+    } catch (const std::exception &e) {
+        std::cerr << file_path << ": CORRUPT (" << e.what() << ")" << std::endl;
+        return 1;
     }
 
-    // Save reconstructed audio as WAV
-    std::string outputFilename = std::filesystem::path(file_path).stem().string() + "_decoded.wav";
-    saveWav(globalSamples, samplingFreq, channelCount, outputFilename);
+    // Save reconstructed audio
+    sink.close();
     return 0;
-}
\ No newline at end of file
+}
+
+
+// Decode a stream in memory and check the result against the CRC-32C of its source, nothing is written. Lossy
+// streams cannot match it, their SNR is measured instead when options.reference_path names the source (read like
+// an encoder input). Prints one line about the file and returns 0 when it is sound.
+int verify(std::string file_path, const CodecOptions &options = CodecOptions()) {
+    std::ifstream inputFile(file_path, std::ios::in | std::ios::binary);
+    if (!inputFile.is_open()) {
+        std::cerr << "Failed to open encoded file: " << file_path << std::endl;
+        return 1;
+    }
+    SampleSource reference;
+    const bool hasReference = !options.reference_path.empty();
+    if (hasReference && !reference.open(options.reference_path, options)) {
+        std::cerr << "Failed to load reference file: " << options.reference_path << std::endl;
+        return 1;
+    }
+
+    std::ostringstream report;  // Written in one piece, files may be verified concurrently
+    report << file_path << ": ";
+    auto result = [&](bool sound) {
+        report << '\n';
+        std::cout << report.str() << std::flush;
+        return sound ? 0 : 1;
+    };
+
+    AudioDecoder decoder;
+    Crc32c checksum;
+    uint64_t decodedSamples = 0;
+    bool referenceShort = false;
+    double signal = 0, noise = 0;
+    std::vector<char> chunk(1 << 20);
+    try {
+        while (inputFile.read(chunk.data(), chunk.size()) || inputFile.gcount() > 0) {
+            decoder.pushBytes(chunk.data(), inputFile.gcount());
+            const std::vector<unsigned char> samples = decoder.pullSamples();
+            if (samples.empty()) continue;
+            const int bytesPerSample = pcmBytes(decoder.getBitsPerSample());
+            const size_t count = samples.size() / bytesPerSample;
+            checksum.update(samples.data(), samples.size());
+            decodedSamples += count;
+            if (!hasReference) continue;
+            if (reference.getBitsPerSample() != decoder.getBitsPerSample()) {
+                report << "REFERENCE MISMATCH (" << pcmFormatName(reference.getBitsPerSample()) << " reference)";
+                return result(false);
+            }
+            const PcmSpan original = reference.next(count);
+            referenceShort = referenceShort || original.size() < count;
+            for (size_t i = 0; i < original.size(); i++) {
+                const double x = pcmValue(original.data() + i * bytesPerSample, decoder.getBitsPerSample());
+                if (!std::isfinite(x)) continue;  // Float infinities and NaNs are kept as they are
+                const double error = x - pcmValue(samples.data() + i * bytesPerSample, decoder.getBitsPerSample());
+                signal += x * x;
+                noise += error * error;
+            }
+        }
+    } catch (const std::exception &e) {
+        report << "CORRUPT (" << e.what() << ")";
+        return result(false);
+    }
+
+    if (!decoder.isFinished()) {
+        report << "TRUNCATED after " << decodedSamples << " samples";
+        return result(false);
+    }
+    if (decodedSamples != decoder.getSampleCount()) {
+        report << "LENGTH MISMATCH (" << decodedSamples << " samples decoded, " << decoder.getSampleCount()
+               << " stored)";
+        return result(false);
+    }
+    if (hasReference && (referenceShort || !reference.next(1).empty())) {
+        report << "REFERENCE MISMATCH (different length)";
+        return result(false);
+    }
+    if (!decoder.isLossy()) {
+        const bool match = checksum.value() == decoder.getChecksum();
+        report << (match ? "OK" : "CHECKSUM MISMATCH") << " (lossless, CRC-32C " << std::hex << std::setw(8)
+               << std::setfill('0') << decoder.getChecksum() << std::dec << ")";
+        return result(match);
+    }
+    report << "OK (lossy";
+    if (hasReference) {
+        report << ", SNR ";
+        if (noise == 0) {
+            report << "inf";
+        } else {
+            report << std::fixed << std::setprecision(2) << 10 * std::log10(signal / noise);
+        }
+        report << " dB";
+    }
+    report << ")";
+    return result(true);
+}
+
+#endif
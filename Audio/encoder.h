@@ -1,127 +1,733 @@
+#ifndef ENCODER
+#define ENCODER
+
+#include <algorithm>
 #include <cmath>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <memory>
 #include <numeric>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
+#include "../Common/crc32c.h"
 #include "../Common/golomb.h"
-#include "./SFML-2.6.2/include/SFML/Audio.hpp"
 #include "./audio_utilities.h"
+#include "./lpc.h"
+#include "./blocksize.h"
+#include "./correction.h"
+#include "./decoder.h"
+#include "./nlms.h"
+#include "./ratecontrol.h"
+#include "./rice.h"
+#include "./stats.h"
+#include "./stereo.h"
+#include "./wide.h"
+
+// How one channel of a frame is coded: its predictor, residuals and their partitioned Rice parameters
+struct ChannelCoding {
+    PredictorType predictor = PREDICTOR_TAYLOR;
+    int taylor_degree = 0;
+    LpcParameters lpc;
+    int32_t constant = 0;         // Value of a constant channel
+    std::vector<int32_t> warmup;  // Samples before the first prediction, all of them for a verbatim channel
+    std::vector<int> residuals;
+    RicePartitioning partitioning;
+    uint64_t bits = 0;            // Exact size of the channel after its predictor type
+};
 
-int encode(std::string file_path, std::string compression_type, int target_bitrate, int taylor_degree) {
-    const int frame_size = 1024;
-    const bool useInterleaving = false;
-    const int max_q_bits = 12;
-    const int bitrate_margin = 5;     // Acceptable error from target bitrate
-    const int max_taylor_degree = 7;  
+// Candidate predictors of one channel, each Taylor degree tried and each LPC order, ranked by their partitioned
+// Rice cost as estimatePartitioning predicts it. Only the winner is partitioned exactly, by finishPredictorCoding.
+// Candidates do not depend on each other, so they are evaluated as separate tasks.
+struct ChannelSearch {
+    Span<const int32_t> channel;
+    int sampleBits = 16;     // Significant bits of the samples, scales the adaptive cascade
+    bool constant = false;
+    int previousDegree = 1;  // Choices of the previous frame, where the reduced effort searches start
+    int previousLpc = 7;     // Order 12
+    std::vector<std::vector<int>> taylorResiduals;  // Indexed by degree
+    std::vector<uint64_t> taylorBits;               // Estimates, UINT64_MAX for degrees not tried on the whole channel
+    int lpcMaxOrder = 0;
+    std::vector<std::vector<double>> lpcCoefficients;
+    std::vector<LpcParameters> lpc;                 // Indexed like LPC_CANDIDATE_ORDERS
+    std::vector<std::vector<int>> lpcResiduals;
+    std::vector<uint64_t> lpcBits;                  // Estimates, UINT64_MAX for orders that do not apply
+};
 
-    int q_bits = compression_type == "lossless" ? 0 : 4;  // Quantization factor in bits
-    bool iterate_over_predictors;
+// Residuals of a channel under a Taylor degree and their estimated partitioned cost, warm-up samples included
+uint64_t evaluateTaylor(Span<const int32_t> channel, int degree, int q_bits, bool useInterleaving,
+                        std::vector<int> &residuals) {
+    taylorResiduals(channel, degree, q_bits, residuals);
+    RicePartitioning partitioning;
+    return estimatePartitioning(residuals, useInterleaving, partitioning) + warmupBits(channel.subspan(0, std::min<size_t>(degree + 1, channel.size())));
+}
 
-    if (taylor_degree == -1) {
-        iterate_over_predictors = true;
-        taylor_degree = 0;
+// Walk from candidate start towards cheaper neighbors until the cost rises, returns the cheapest candidate seen
+// and its cost. Costs are convex enough in the Taylor degree and LPC order that this rarely misses the best one.
+template <typename Cost>
+int climbCandidates(int count, int start, Cost cost, uint64_t &best_cost) {
+    int best = std::max(0, std::min(count - 1, start));
+    best_cost = cost(best);
+    for (int direction = -1; direction <= 1; direction += 2) {
+        const int origin = best;
+        for (int candidate = best + direction; candidate >= 0 && candidate < count; candidate += direction) {
+            const uint64_t candidate_cost = cost(candidate);
+            if (candidate_cost >= best_cost) break;
+            best = candidate;
+            best_cost = candidate_cost;
+        }
+        if (best != origin) break;  // Going down already paid off, the other side was worse
     }
+    return best;
+}
 
-    // Load source file
-    sf::SoundBuffer buffer;
-    if (!buffer.loadFromFile(file_path)) {
-        std::cerr << "Failed to load WAV file: " << file_path << std::endl;
-        return 1;
+// Predictor search effort: every candidate at the maximum, otherwise the Taylor degree and (from effort 1) the
+// LPC order climb from the previous frame's choices, ranked below effort 2 on the middle quarter of the channel
+// and then evaluated in full
+const int MAX_SEARCH_EFFORT = 3;
+
+void climbChannelSearch(ChannelSearch &search, int q_bits, bool useInterleaving, const CodecOptions &options) {
+    const Span<const int32_t> channel = search.channel;
+    const bool subsample = options.search_effort < 2 && channel.size() >= 4 * (size_t)MIN_BLOCK_SIZE;
+    const Span<const int32_t> sample =
+        subsample ? channel.subspan(channel.size() * 3 / 8, channel.size() / 4) : channel;
+
+    uint64_t bits;
+    const int degree = climbCandidates(
+        MAX_TAYLOR_DEGREE + 1, search.previousDegree,
+        [&](int degree) {
+            return evaluateTaylor(sample, degree, q_bits, useInterleaving, search.taylorResiduals[degree]);
+        },
+        bits);
+    search.taylorBits[degree] =
+        subsample ? evaluateTaylor(channel, degree, q_bits, useInterleaving, search.taylorResiduals[degree]) : bits;
+
+    if (options.search_effort == 0 || options.lpc_order == 0) return;
+    search.lpcMaxOrder = analyzeLpc(channel, options.lpc_order, search.lpcCoefficients);
+    int candidates = 0;
+    while (candidates < LPC_CANDIDATE_COUNT && LPC_CANDIDATE_ORDERS[candidates] <= search.lpcMaxOrder) candidates++;
+    if (candidates == 0) return;
+    auto evaluate = [&](Span<const int32_t> samples, int candidate) {
+        uint64_t bits;
+        if (!evaluateLpc(samples, search.lpcCoefficients[LPC_CANDIDATE_ORDERS[candidate] - 1], q_bits,
+                         useInterleaving, search.lpc[candidate], search.lpcResiduals[candidate], bits)) {
+            return UINT64_MAX;
+        }
+        return bits;
+    };
+    const int best = climbCandidates(
+        candidates, search.previousLpc, [&](int candidate) { return evaluate(sample, candidate); }, bits);
+    search.lpcBits[best] = subsample ? evaluate(channel, best) : bits;
+}
+
+// Refine the residuals of the predictor chosen for a channel in high compression mode and partition them, storing
+// the channel verbatim when prediction would not shrink it
+void finishPredictorCoding(const ChannelSearch &search, int q_bits, bool useInterleaving, const CodecOptions &options,
+                           ChannelCoding &coding) {
+    const Span<const int32_t> channel = search.channel;
+
+    // In high compression mode the adaptive cascade refines the residuals of whichever fixed predictor won
+    if (options.high_compression) {
+        if (coding.predictor == PREDICTOR_LPC) {
+            LpcFilter filter(coding.lpc, channel.size());
+            nlmsResiduals(channel, search.sampleBits, filter, q_bits, coding.residuals);
+        } else {
+            TaylorFilter filter(coding.taylor_degree, channel.size());
+            nlmsResiduals(channel, search.sampleBits, filter, q_bits, coding.residuals);
+        }
+    }
+
+    // The residuals that win are coded with per-partition parameters after the warm-up samples
+    const size_t warmup = std::min<size_t>(channel.size(), coding.predictor == PREDICTOR_LPC ? coding.lpc.order
+                                                                                            : coding.taylor_degree + 1);
+    coding.warmup.assign(channel.begin(), channel.begin() + warmup);
+    coding.bits = choosePartitioning(coding.residuals, useInterleaving, coding.partitioning) +
+                  (coding.predictor == PREDICTOR_LPC ? lpcHeaderBits(coding.lpc) : 3) +
+                  warmupBits(channel.subspan(0, warmup));
+    if (storedSampleBits(channel) <= coding.bits) {
+        coding.predictor = PREDICTOR_VERBATIM;
+        coding.warmup.assign(channel.begin(), channel.end());
+        coding.residuals.clear();
+        coding.bits = storedSampleBits(channel);
+    }
+}
+
+// Keep the candidate whose residuals take the fewest estimated partitioned bits (the lowest Taylor degree or LPC
+// order on ties), then refine its residuals in high compression mode and partition them. Channels that prediction
+// would not shrink are stored verbatim.
+void finishChannelCoding(ChannelSearch &search, int q_bits, bool useInterleaving, const CodecOptions &options,
+                         ChannelCoding &coding) {
+    const Span<const int32_t> channel = search.channel;
+    if (search.constant) {
+        coding.predictor = PREDICTOR_CONSTANT;
+        coding.constant = channel.empty() ? 0 : channel[0];
+        coding.residuals.clear();
+        coding.bits = storedSampleBits(Span<const int32_t>(&coding.constant, 1));
+        return;
+    }
+
+    uint64_t min_bits = UINT64_MAX;
+    for (int degree = 0; degree <= MAX_TAYLOR_DEGREE; degree++) {
+        if (search.taylorBits[degree] < min_bits) {
+            min_bits = search.taylorBits[degree];
+            coding.taylor_degree = degree;
+        }
+    }
+    coding.predictor = PREDICTOR_TAYLOR;
+    coding.residuals.swap(search.taylorResiduals[coding.taylor_degree]);
+    search.previousDegree = coding.taylor_degree;
+
+    // Linear prediction wins when its residuals plus coefficients cost less than the Taylor degree
+    int best_lpc = -1;
+    for (int candidate = 0; candidate < (int)search.lpcBits.size(); candidate++) {
+        if (search.lpcBits[candidate] != UINT64_MAX &&
+            (best_lpc < 0 || search.lpcBits[candidate] < search.lpcBits[best_lpc])) {
+            best_lpc = candidate;
+        }
+    }
+    if (best_lpc >= 0) search.previousLpc = best_lpc;
+    if (best_lpc >= 0 && search.lpcBits[best_lpc] < min_bits + 3) {  // The Taylor degree takes 3 header bits
+        coding.predictor = PREDICTOR_LPC;
+        coding.lpc = search.lpc[best_lpc];
+        coding.residuals.swap(search.lpcResiduals[best_lpc]);
+    }
+    finishPredictorCoding(search, q_bits, useInterleaving, options, coding);
+}
+
+// Choose the coding of every channel of a frame: each Taylor degree (only taylor_degree unless it is -1) and each
+// LPC order, constant channels skipping the search. The candidates of all the channels run as independent tasks,
+// concurrently when a worker group is given, and are reduced once every one of them is known. searches is kept
+// from frame to frame so the candidate buffers are reused. sampleBits is the significant bits of the samples.
+void chooseFrameCoding(const std::vector<std::vector<int32_t>> &channels, int sampleBits, int taylor_degree,
+                       int q_bits, bool useInterleaving, const CodecOptions &options, WorkerGroup *workers,
+                       std::vector<ChannelSearch> &searches, std::vector<ChannelCoding> &codings,
+                       EncoderStats *stats = nullptr) {
+    std::optional<StageTimer> timer(std::in_place, stats, STAGE_SEARCH);
+    const size_t channelCount = channels.size();
+    const bool iterate_over_predictors = taylor_degree == -1;
+    const int first_degree = iterate_over_predictors ? 0 : taylor_degree;
+    const int degrees = iterate_over_predictors ? MAX_TAYLOR_DEGREE + 1 : 1;
+    const bool useLpc = iterate_over_predictors && options.lpc_order > 0;
+
+    searches.resize(channelCount);
+    for (size_t c = 0; c < channelCount; c++) {
+        ChannelSearch &search = searches[c];
+        search.channel = Span<const int32_t>(channels[c].data(), channels[c].size());
+        search.sampleBits = sampleBits;
+        int32_t minimum, maximum;
+        sampleRange(search.channel, minimum, maximum);
+        search.constant = minimum == maximum;
+        search.taylorResiduals.resize(MAX_TAYLOR_DEGREE + 1);
+        search.taylorBits.assign(MAX_TAYLOR_DEGREE + 1, UINT64_MAX);
+        search.lpc.resize(LPC_CANDIDATE_COUNT);
+        search.lpcResiduals.resize(LPC_CANDIDATE_COUNT);
+        search.lpcBits.assign(useLpc ? LPC_CANDIDATE_COUNT : 0, UINT64_MAX);
+    }
+
+    if (iterate_over_predictors && options.search_effort < MAX_SEARCH_EFFORT) {
+        // Below the maximum effort each channel climbs through its candidates on its own
+        runTasks(workers, channelCount, [&](size_t c) {
+            if (!searches[c].constant) climbChannelSearch(searches[c], q_bits, useInterleaving, options);
+        });
+    } else {
+        // Taylor degrees and the LPC analysis
+        const size_t stage_tasks = degrees + (useLpc ? 1 : 0);
+        runTasks(workers, channelCount * stage_tasks, [&](size_t task) {
+            ChannelSearch &search = searches[task / stage_tasks];
+            const int candidate = task % stage_tasks;
+            if (search.constant) return;
+            if (candidate < degrees) {
+                const int degree = first_degree + candidate;
+                search.taylorBits[degree] =
+                    evaluateTaylor(search.channel, degree, q_bits, useInterleaving, search.taylorResiduals[degree]);
+            } else {
+                search.lpcMaxOrder = analyzeLpc(search.channel, options.lpc_order, search.lpcCoefficients);
+            }
+        });
+
+        // LPC orders, from the coefficients of the analysis
+        if (useLpc) {
+            runTasks(workers, channelCount * LPC_CANDIDATE_COUNT, [&](size_t task) {
+                ChannelSearch &search = searches[task / LPC_CANDIDATE_COUNT];
+                const int candidate = task % LPC_CANDIDATE_COUNT;
+                const int order = LPC_CANDIDATE_ORDERS[candidate];
+                if (search.constant || order > search.lpcMaxOrder) return;
+                if (!evaluateLpc(search.channel, search.lpcCoefficients[order - 1], q_bits, useInterleaving,
+                                 search.lpc[candidate], search.lpcResiduals[candidate], search.lpcBits[candidate])) {
+                    search.lpcBits[candidate] = UINT64_MAX;
+                }
+            });
+        }
+    }
+
+    timer.emplace(stats, STAGE_PARTITION);
+    codings.resize(channelCount);
+    runTasks(workers, channelCount,
+             [&](size_t c) { finishChannelCoding(searches[c], q_bits, useInterleaving, options, codings[c]); });
+}
+
+// Write the channel header and residuals (samples of a verbatim channel), returns the residual bits
+int writeChannel(BitStream &stream, const ChannelCoding &coding, bool useInterleaving) {
+    stream.writeBits(coding.predictor, PREDICTOR_TYPE_BITS);
+    if (coding.predictor == PREDICTOR_CONSTANT) {
+        writeStoredSamples(stream, Span<const int32_t>(&coding.constant, 1));
+        return 0;
+    }
+    const Span<const int32_t> stored(coding.warmup.data(), coding.warmup.size());
+    if (coding.predictor == PREDICTOR_VERBATIM) {
+        writeStoredSamples(stream, stored);
+        return storedSampleBits(stored);
+    }
+    if (coding.predictor == PREDICTOR_LPC) {
+        writeLpcParameters(stream, coding.lpc);
+    } else {
+        stream.writeBits(coding.taylor_degree, 3);
+    }
+    writeWarmup(stream, stored);
+    return writePartitionedResiduals(stream, coding.residuals, coding.partitioning, useInterleaving);
+}
+
+// Samples per channel of the frames coded with options, the header keeps the largest when block sizes are searched.
+// The adaptive filters restart with every frame, so they get longer frames to converge in.
+int channelFrameSize(const CodecOptions &options) {
+    return options.block_effort > 0 ? MAX_BLOCK_SIZE : (options.high_compression ? 8192 : 1024);
+}
+
+// Streaming encoder with no filesystem side effects, so the codec can be embedded. Interleaved PCM in the format
+// given at construction goes in through pushSamples, in chunks of any size, and the .g7a stream comes out through
+// pullBytes: the header first, then each frame as soon as its window of input is complete. finish() codes what is
+// left and ends the stream. The header holds sampleCount when it is known up front and the streaming marker
+// otherwise, callers that can seek back may overwrite it with headerBytes() once done. Invalid formats throw
+// std::invalid_argument.
+class AudioEncoder {
+   public:
+    static constexpr bool useInterleaving = false;  // Residual coding of the streams written
+
+   private:
+    CodecOptions options;
+    bool lossy;
+    int taylor_degree;
+    unsigned int channelCount;
+    unsigned int sampleRate;
+    int bitsPerSample;
+    int channel_frame_size;
+    size_t window_size;  // Interleaved samples per window
+    std::ostringstream output;
+    BitStream stream;
+    RateController rateController;
+    std::unique_ptr<WorkerGroup> workers;
+    bool exhaustive_stereo;
+    std::vector<ChannelSearch> searches;
+    std::vector<unsigned char> pending;  // Input of the incomplete window
+    uint32_t sampleCount = 0;
+    Crc32c checksum;  // Of the source PCM, for verification after decoding
+    std::ostringstream correctionOutput;
+    std::unique_ptr<BitStream> correctionStream;  // Hybrid mode only
+    bool finished = false;
+    EncoderStats *stats = nullptr;
+
+    static int checkedBits(unsigned int channelCount, int bitsPerSample) {
+        if (channelCount == 0 || channelCount > 15) throw std::invalid_argument("Unsupported channel count");
+        if (!isSupportedBitDepth(bitsPerSample)) throw std::invalid_argument("Unsupported sample size");
+        return bitsPerSample;
+    }
+
+    // -1 searches every degree, otherwise the fixed Taylor degree
+    static int checkedDegree(int taylor_degree) {
+        if (taylor_degree < -1 || taylor_degree > MAX_TAYLOR_DEGREE) {
+            throw std::invalid_argument("Unsupported predictor degree " + std::to_string(taylor_degree));
+        }
+        return taylor_degree;
+    }
+
+    // Samples of input the predictors code: input itself, or for 32-bit formats its core samples split into wide
+    PcmSpan coreSamples(PcmSpan input, WideFrame &wide) const {
+        if (!isWidePcm(bitsPerSample)) return input;
+        splitWideFrame(input, bitsPerSample, wide);
+        return wide.core();
+    }
+
+    // Encode one frame of interleaved samples
+    void encodeFrame(PcmSpan frameInput) {
+        const int currentFrameSize = frameInput.size();
+        const int coreBits = codedSampleBits(bitsPerSample);
+
+        // Deinterleave once without the wasted bits and decorrelate stereo pairs, every channel is then predicted
+        // on its own
+        int shift = 0;
+        std::vector<std::vector<int32_t>> channels;
+        WideFrame wide;
+        {
+            StageTimer timer(stats, STAGE_LOAD);
+            const PcmSpan core = coreSamples(frameInput, wide);
+            withPcmFormat(coreBits, [&](auto format) {
+                using Format = decltype(format);
+                shift = wastedBits<Format>(core);
+                deinterleave<Format>(core, channelCount, channels, shift);
+            });
+        }
+        std::optional<StageTimer> timer(std::in_place, stats, STAGE_SEARCH);
+        StereoMode stereo_mode = STEREO_INDEPENDENT;
+        std::vector<std::vector<int32_t>> stereoChannels;  // Left, right, mid and side
+        if (channelCount == 2) {
+            if (exhaustive_stereo) {
+                stereoChannels = {channels[0], channels[1], channels[0], channels[1]};
+                applyStereoMode(STEREO_MID_SIDE, stereoChannels[2], stereoChannels[3]);
+            }
+            stereo_mode = chooseStereoMode(channels[0], channels[1]);
+            applyStereoMode(stereo_mode, channels[0], channels[1]);
+        }
+
+        // Quantize as finely as the bitrate allows, judging from the frame's own statistics
+        int q_bits = 0;
+        std::vector<double> estimatedBits;
+        if (lossy) {
+            estimatedBits = rateController.estimateFrameBits(channels);
+            q_bits = rateController.chooseQBits(estimatedBits, currentFrameSize, rateController.qualityLimit(channels));
+        }
+        timer.reset();
+
+        std::vector<ChannelCoding> codings;
+        if (exhaustive_stereo) {
+            std::vector<ChannelCoding> candidates;
+            chooseFrameCoding(stereoChannels, coreBits - shift, taylor_degree, q_bits, useInterleaving, options,
+                              workers.get(), searches, candidates, stats);
+            auto pairBits = [&](int mode) {
+                return candidates[STEREO_CHANNELS[mode][0]].bits + candidates[STEREO_CHANNELS[mode][1]].bits;
+            };
+            for (int mode = STEREO_INDEPENDENT; mode <= STEREO_MID_SIDE; mode++) {
+                if (pairBits(mode) < pairBits(stereo_mode)) stereo_mode = (StereoMode)mode;
+            }
+            codings.push_back(std::move(candidates[STEREO_CHANNELS[stereo_mode][0]]));
+            codings.push_back(std::move(candidates[STEREO_CHANNELS[stereo_mode][1]]));
+        } else {
+            chooseFrameCoding(channels, coreBits - shift, taylor_degree, q_bits, useInterleaving, options,
+                              workers.get(), searches, codings, stats);
+        }
+        if (stats) recordFrame(codings, currentFrameSize, q_bits, shift, stereo_mode);
+
+        // Each frame goes into its own byte-aligned block so decoders can locate it without parsing the previous ones
+        timer.emplace(stats, STAGE_EMIT);
+        std::ostringstream frameBuffer;
+        {
+            BitStream frameStream(frameBuffer);
+
+            // Write frame header, the size comes first so decoders can index frames without decoding them
+            writeBlockSize(frameStream, currentFrameSize, channelCount);
+            frameStream.writeBits(q_bits, 4);
+            frameStream.writeBit(shift > 0);
+            if (shift > 0) frameStream.writeBits(shift, WASTED_SHIFT_BITS);
+            if (channelCount == 2) frameStream.writeBits(stereo_mode, STEREO_MODE_BITS);
+
+            // Write the channels one after the other
+            for (const ChannelCoding &coding : codings) {
+                writeChannel(frameStream, coding, useInterleaving);
+            }
+            if (isWidePcm(bitsPerSample)) writeWideExtension(frameStream, wide, bitsPerSample, !lossy);
+        }
+        const std::string frameBytes = frameBuffer.str();
+        timer.emplace(stats, STAGE_OUTPUT);
+        if (stats) {
+            stats->frames++;
+            stats->frameBits += (FRAME_LENGTH_BITS / 8 + frameBytes.size()) * 8;
+        }
+        writeFrame(stream, frameBytes);
+
+        // The correction is taken against the frame exactly as decoders will reconstruct it
+        if (correctionStream) {
+            timer.emplace(stats, STAGE_EMIT);
+            std::vector<unsigned char> decoded(frameInput.size() * frameInput.bytesPerSample());
+            std::istringstream frame(frameBytes);
+            BitStream decodeStream(frame);
+            int frameQBits;
+            decodeFrame(decodeStream, channelCount, bitsPerSample, useInterleaving, options.high_compression,
+                        decoded.data(), frameInput.size(), &frameQBits);
+            writeFrame(*correctionStream,
+                       correctionFrame(frameInput, decoded.data(), frameQBits, channelCount, bitsPerSample));
+        }
+        if (lossy) rateController.update(estimatedBits[q_bits], (FRAME_LENGTH_BITS / 8 + frameBytes.size()) * 8, currentFrameSize);
+    }
+
+    // Predictor, partitioning and size of each channel of a frame
+    void recordFrame(const std::vector<ChannelCoding> &codings, int frameSize, int q_bits, int shift,
+                     StereoMode stereo_mode) {
+        for (size_t c = 0; c < codings.size(); c++) {
+            const ChannelCoding &coding = codings[c];
+            ChannelStats channel;
+            channel.frame = stats->frames;
+            channel.channel = c;
+            channel.samples = channelLength(frameSize, channelCount, c);
+            channel.q_bits = q_bits;
+            channel.shift = shift;
+            channel.stereo_mode = stereo_mode;
+            channel.predictor = PREDICTOR_NAMES[coding.predictor];
+            if (coding.predictor == PREDICTOR_TAYLOR) channel.taylor_degree = coding.taylor_degree;
+            if (coding.predictor == PREDICTOR_LPC) channel.lpc_order = coding.lpc.order;
+            if (coding.predictor == PREDICTOR_TAYLOR || coding.predictor == PREDICTOR_LPC) {
+                channel.rice_order = coding.partitioning.order;
+                const auto range = std::minmax_element(coding.partitioning.parameters.begin(),
+                                                       coding.partitioning.parameters.end());
+                if (range.first != coding.partitioning.parameters.end()) {
+                    channel.m_min = riceM(*range.first);
+                    channel.m_max = riceM(*range.second);
+                }
+            }
+            channel.bits = PREDICTOR_TYPE_BITS + coding.bits;
+            stats->channels.push_back(channel);
+        }
+    }
+
+    // Encode a window of input, split into frames when searching block sizes
+    void encodeWindow(PcmSpan windowInput) {
+        sampleCount += windowInput.size();
+        checksum.update(windowInput.data(), windowInput.size() * windowInput.bytesPerSample());
+        std::vector<int> frameSizes;
+        if (options.block_effort > 0 && windowInput.size() == window_size) {
+            StageTimer timer(stats, STAGE_SEARCH);
+            std::vector<std::vector<int32_t>> channels;
+            WideFrame wide;
+            const PcmSpan core = coreSamples(windowInput, wide);
+            withPcmFormat(codedSampleBits(bitsPerSample),
+                          [&](auto format) { deinterleave<decltype(format)>(core, channelCount, channels); });
+            for (int block : BlockSplitter(channels, options.block_effort).blocks()) frameSizes.push_back(block * channelCount);
+        } else {
+            frameSizes.push_back(windowInput.size());
+        }
+
+        size_t frameStart = 0;
+        for (int currentFrameSize : frameSizes) {
+            encodeFrame(windowInput.subspan(frameStart, currentFrameSize));
+            frameStart += currentFrameSize;
+        }
     }
-    printAudioInfo(buffer);
-
-    unsigned int channelCount = buffer.getChannelCount();
-    const uint32_t sampleCount = buffer.getSampleCount();
-    const sf::Int16 *samples = buffer.getSamples();
-    const std::vector<sf::Int16> globalSamples(samples, samples + sampleCount);
-
-    // Open destination file
-    BitStream stream("./outputs/encoded_audio/" + std::filesystem::path(file_path).stem().string() + ".g7a", true);
-    writeHeader(stream, channelCount, buffer.getSampleRate(), frame_size, (uint32_t)buffer.getSampleCount(), useInterleaving);
-
-    // Open a CSV file to log the taylor degrees used
-    std::ofstream csvFile;
-    csvFile.open("taylor_degrees.csv", std::ios::app);
-
-    // Iterate through samples frame by frame
-    for (uint32_t frameStart = 0; frameStart < sampleCount; frameStart += frame_size) {
-        // Determine the current frame size (might be smaller for the last frame)
-        int currentFrameSize = std::min(frame_size, (int)(sampleCount - frameStart));
-        int frame_taylor_degree = taylor_degree == -1 ? 0 : taylor_degree;
-
-        // Keep track of samples and residuals for different taylor degrees
-        std::vector<std::vector<sf::Int16>> vector_frameSamples;
-        std::vector<std::vector<int>> vector_frameResiduals;
-        std::vector<double> entropy;
-        for (int i = 0; i <= max_taylor_degree; i++) {
-            vector_frameSamples.emplace_back();
-            vector_frameResiduals.emplace_back();
-        }
-
-        // Apply the predictor and compute residuals for each degree
-        do {
-            vector_frameSamples[frame_taylor_degree].reserve(currentFrameSize);
-            vector_frameResiduals[frame_taylor_degree].reserve(currentFrameSize);
-            for (int i = 0; i < currentFrameSize; ++i) {
-                int predicted = predictor_taylor(frame_taylor_degree, channelCount, vector_frameSamples[frame_taylor_degree]);
-                int residual = (globalSamples[frameStart + i] - predicted);
-                residual = residual >> q_bits;
-                vector_frameResiduals[frame_taylor_degree].push_back(residual);
-                vector_frameSamples[frame_taylor_degree].push_back(predicted + (residual << q_bits));
+
+   public:
+    // Lossy encoding (target_bitrate in kbps) quantizes every frame as finely as the bitrate allows. taylor_degree
+    // fixes the Taylor predictor, -1 searches every predictor.
+    AudioEncoder(unsigned int channelCount, unsigned int sampleRate, int bitsPerSample, bool lossy, int target_bitrate,
+                 int taylor_degree, const CodecOptions &options = CodecOptions(), uint32_t sampleCount = STREAMING_LENGTH)
+        : options(options),
+          lossy(lossy),
+          taylor_degree(checkedDegree(taylor_degree)),
+          channelCount(channelCount),
+          sampleRate(sampleRate),
+          bitsPerSample(checkedBits(channelCount, bitsPerSample)),
+          channel_frame_size(channelFrameSize(options)),
+          window_size((size_t)channel_frame_size * channelCount),
+          stream(output),
+          // 12 for 16-bit input, the frame header allows 15
+          rateController(target_bitrate, sampleRate, channelCount, options.vbv_milliseconds,
+                         std::min(15, codedSampleBits(bitsPerSample) - 4)),
+          // Low latency mode evaluates the candidates of a frame on a worker group kept for the whole stream, and
+          // codes every stereo pairing instead of trusting the estimate
+          workers(options.low_latency ? new WorkerGroup(options.latency_threads) : nullptr),
+          exhaustive_stereo(workers && channelCount == 2) {
+        writeHeader(stream, channelCount, sampleRate, bitsPerSample, channel_frame_size, sampleCount, useInterleaving,
+                    options.high_compression);
+        stream.alignToByte();
+    }
+
+    // Append interleaved samples in the encoder's PCM format, whole windows are coded straight from the caller's
+    // buffer and the rest is kept until its window fills up
+    void pushSamples(PcmSpan samples) {
+        if (finished) throw std::logic_error("Samples pushed after finish");
+        if (samples.bytesPerSample() != pcmBytes(bitsPerSample)) throw std::invalid_argument("Sample size mismatch");
+        const int bytesPerSample = pcmBytes(bitsPerSample);
+        size_t offset = 0;
+        while (offset < samples.size()) {
+            if (pending.empty() && samples.size() - offset >= window_size) {
+                encodeWindow(samples.subspan(offset, window_size));
+                offset += window_size;
+                continue;
             }
-            entropy.push_back(get_entropy(vector_frameResiduals[frame_taylor_degree]));
-            //cout << ' ' << get_entropy(vector_frameResiduals[frame_taylor_degree]) << ' ';
-            frame_taylor_degree++;
-        } while (iterate_over_predictors && frame_taylor_degree <= max_taylor_degree);
-
-        // Find the taylor_degree that minimizes entropy
-        double min_entropy = 1000;
-        int min_entropy_degree = -1;
-        for(int i = 0; i < entropy.size(); i++){
-            if(entropy[i] < min_entropy){
-                min_entropy = entropy[i];
-                min_entropy_degree = i;
+            const size_t count = std::min(window_size - pending.size() / bytesPerSample, samples.size() - offset);
+            const unsigned char *bytes = samples.subspan(offset, count).data();
+            pending.insert(pending.end(), bytes, bytes + count * bytesPerSample);
+            offset += count;
+            if (pending.size() == window_size * bytesPerSample) {
+                encodeWindow(PcmSpan(pending.data(), window_size, bytesPerSample));
+                pending.clear();
             }
         }
-        //cout << "Taylor degree with least entropy: " << min_entropy_degree << endl;
+    }
 
-        // Calculate optimal Golomb M
-        int sum_values = std::accumulate(vector_frameResiduals[min_entropy_degree].begin(), vector_frameResiduals[min_entropy_degree].end(),
-                                         0, [](int acc, int val) { return acc + std::abs(val); });
-        double average = static_cast<double>(sum_values) / vector_frameResiduals[min_entropy_degree].size();
-        if (useInterleaving) average *= 2;
-        int m = static_cast<int>(std::ceil(-1 / std::log2(1 - (1 / (average + 1)))));
-        if (m <= 1) m = 2;
+    // Append interleaved 16-bit samples (16-bit encoders only)
+    void pushSamples(Span<const int16_t> samples) {
+        std::vector<unsigned char> bytes(samples.size() * 2);
+        for (size_t i = 0; i < samples.size(); i++) PcmFormat<16>::store(&bytes[i * 2], samples[i]);
+        pushSamples(PcmSpan(bytes.data(), samples.size(), 2));
+    }
 
-        csvFile << min_entropy_degree << '\n';
-        // cout << "Encoding frame starting at sample " << frameStart << " with size " << currentFrameSize << endl;
-        // cout << " Golomb M: " << m << " Average residual: " << average << " Q_bits: " << q_bits << endl;
+    // Code the last, possibly partial, window and end the stream
+    void finish() {
+        if (finished) return;
+        const int bytesPerSample = pcmBytes(bitsPerSample);
+        if (!pending.empty()) encodeWindow(PcmSpan(pending.data(), pending.size() / bytesPerSample, bytesPerSample));
+        pending.clear();
+        writeEndOfFrames(stream, sampleCount, checksum.value());
+        stream.alignToByte();
+        if (correctionStream) {
+            writeEndOfFrames(*correctionStream, sampleCount, checksum.value());
+            correctionStream->alignToByte();
+        }
+        finished = true;
+    }
 
-        // Write frame header
-        stream.writeBits(m, 16);
-        stream.writeBits(q_bits, 4);
-        stream.writeBits(min_entropy_degree, 3);
+    // Encoded bytes produced since the last call
+    std::string pullBytes() {
+        std::string bytes = output.str();
+        output.str("");
+        return bytes;
+    }
 
-        // Write the residuals to the file
-        Golomb golomb(m, useInterleaving);
-        int bits_written = 0;
-        for (int i = 0; i < currentFrameSize; ++i) {
-            bits_written += golomb.encode(stream, vector_frameResiduals[min_entropy_degree][i]);
+    // Also produce the correction stream of hybrid coding (see correction.h), before any sample is pushed
+    void enableCorrection() {
+        if (sampleCount > 0 || !pending.empty()) throw std::logic_error("Correction enabled after samples");
+        if (correctionStream) return;
+        if (isWidePcm(bitsPerSample)) throw std::invalid_argument("Hybrid coding supports up to 24-bit samples");
+        correctionStream.reset(new BitStream(correctionOutput));
+        writeCorrectionHeader(*correctionStream, channelCount, bitsPerSample);
+    }
+
+    // Correction bytes produced since the last call
+    std::string pullCorrectionBytes() {
+        std::string bytes = correctionOutput.str();
+        correctionOutput.str("");
+        return bytes;
+    }
+
+    // Stream header holding the number of samples pushed so far, to replace a streaming marker
+    std::string headerBytes() const {
+        std::ostringstream header;
+        {
+            BitStream headerStream(header);
+            writeHeader(headerStream, channelCount, sampleRate, bitsPerSample, channel_frame_size, sampleCount,
+                        useInterleaving, options.high_compression);
         }
+        return header.str();
+    }
+
+    // Collect stage timings and per-frame decisions into stats from now on, nullptr stops collecting
+    void setStats(EncoderStats *encoderStats) { stats = encoderStats; }
 
-        // Calculate bitrate used and adapt quantization if needed
-        if (compression_type == "lossy") {
-            double frame_time = (double)currentFrameSize / (buffer.getSampleRate() * channelCount);
-            double bitrate = (double)bits_written / (frame_time * 1000);  // in kbps
-            if (bitrate < target_bitrate + bitrate_margin && q_bits > 0)
-                q_bits--;
-            else if (bitrate > target_bitrate - bitrate_margin && q_bits < max_q_bits)
-                q_bits++;
-            //cout << "Frame bitrate (kbps): " << bitrate << " Target: " << target_bitrate << " Q_bits: " << q_bits << endl;
+    // Interleaved samples per window, pushing whole windows avoids copying the input
+    size_t windowSize() const { return window_size; }
+    uint32_t getSampleCount() const { return sampleCount; }
+    // Lossy frames coded above the target bitrate, which was too low to keep their signal above the noise
+    int getFramesOverTarget() const { return rateController.getLimitedFrames(); }
+};
+
+int encode(std::string file_path, std::string compression_type, int target_bitrate, int taylor_degree,
+           const CodecOptions &options = CodecOptions()) {
+    // Open source file, samples are pulled one window at a time
+    SampleSource source;
+    if (!source.open(file_path, options)) {
+        std::cerr << "Failed to load audio file: " << file_path << std::endl;
+        return 1;
+    }
+
+    // Formats the codec cannot hold (more than 15 channels, hybrid coding of 32-bit samples) are refused before any
+    // output is created
+    const uint32_t headerSampleCount = source.getSampleCount() > STREAMING_LENGTH ? STREAMING_LENGTH : source.getSampleCount();
+    std::unique_ptr<AudioEncoder> audioEncoder;
+    try {
+        audioEncoder.reset(new AudioEncoder(source.getChannelCount(), source.getSampleRate(), source.getBitsPerSample(),
+                                            compression_type == "lossy", target_bitrate, taylor_degree, options,
+                                            headerSampleCount));
+        if (!options.correction_path.empty()) audioEncoder->enableCorrection();
+    } catch (const std::invalid_argument &e) {
+        std::cerr << "Cannot encode " << file_path << ": " << e.what() << std::endl;
+        return 1;
+    }
+    AudioEncoder &encoder = *audioEncoder;
+
+    // Open destination file, stdout can't be rewound so its header keeps the streaming length marker
+    std::string output_path = options.output_path;
+    if (output_path.empty()) {
+        std::filesystem::create_directories("./outputs/encoded_audio/");
+        output_path = "./outputs/encoded_audio/" + std::filesystem::path(file_path).stem().string() + ".g7a";
+    }
+    const bool toStdout = output_path == "-";
+    std::ofstream outputFile;
+    if (toStdout) {
+        setBinaryMode(stdout);
+    } else {
+        outputFile.open(output_path, std::ios::out | std::ios::binary);
+        if (!outputFile.is_open()) {
+            std::cerr << "Failed to open output file: " << output_path << std::endl;
+            return 1;
         }
     }
-    csvFile.close();
+    if (!options.quiet) printAudioInfo(source, toStdout ? std::cerr : std::cout);
+
+    // Stage timings and per-frame decisions, only collected when asked for
+    std::unique_ptr<EncoderStats> stats;
+    if (!options.stats_path.empty()) {
+        stats.reset(new EncoderStats());
+        encoder.setStats(stats.get());
+    }
+
+    // Hybrid coding writes the correction of the lossy stream next to it
+    std::ofstream correctionFile;
+    if (!options.correction_path.empty()) {
+        correctionFile.open(options.correction_path, std::ios::out | std::ios::binary);
+        if (!correctionFile.is_open()) {
+            std::cerr << "Failed to open correction file: " << options.correction_path << std::endl;
+            return 1;
+        }
+    }
+
+    // Iterate through the input a window at a time, only the current window is kept in memory
+    std::ostream &out = toStdout ? std::cout : outputFile;
+    auto flush = [&]() {
+        StageTimer timer(stats.get(), STAGE_OUTPUT);
+        const std::string bytes = encoder.pullBytes();
+        out.write(bytes.data(), bytes.size());
+        const std::string correction = encoder.pullCorrectionBytes();
+        correctionFile.write(correction.data(), correction.size());
+    };
+    auto next = [&]() {
+        StageTimer timer(stats.get(), STAGE_LOAD);
+        return source.next(encoder.windowSize());
+    };
+    for (PcmSpan windowInput = next(); !windowInput.empty(); windowInput = next()) {
+        encoder.pushSamples(windowInput);
+        flush();
+    }
+    encoder.finish();
+    flush();
+    if (encoder.getFramesOverTarget() > 0) {
+        std::cerr << "Warning: " << target_bitrate << " kbps is too low for " << file_path << ", "
+                  << encoder.getFramesOverTarget() << " frames exceed it to keep their signal above the noise"
+                  << std::endl;
+    }
+
+    // Fill in the real sample count once the whole input has been seen
+    if (!toStdout && headerSampleCount != encoder.getSampleCount()) {
+        const std::string header = encoder.headerBytes();
+        outputFile.seekp(0);
+        outputFile.write(header.data(), header.size());
+    }
+
+    if (stats) {
+        // A .csv path gets the per-channel rows only, anything else the whole report as JSON
+        std::ofstream statsFile(options.stats_path);
+        if (!statsFile.is_open()) {
+            std::cerr << "Failed to open stats file: " << options.stats_path << std::endl;
+            return 1;
+        }
+        if (std::filesystem::path(options.stats_path).extension() == ".csv") {
+            stats->writeCsv(statsFile);
+        } else {
+            stats->writeJson(statsFile);
+        }
+        if (!options.quiet) stats->printStages(toStdout ? std::cerr : std::cout);
+    }
     return 0;
 }
+
+#endif
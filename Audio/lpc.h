@@ -0,0 +1,219 @@
+#ifndef LPC
+#define LPC
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "../Common/bitStream.h"
+#include "./audio_utilities.h"
+#include "./rice.h"
+
+// Linear prediction (autocorrelation + Levinson-Durbin) with quantized coefficients, FLAC style.
+// Like the Taylor predictor it runs on one (contiguous) channel of a frame at a time.
+
+const int LPC_MAX_ORDER = 32;
+const int LPC_PRECISION = 12;  // Bits per quantized coefficient, sign included
+const int LPC_MAX_SHIFT = 31;
+
+struct LpcParameters {
+    int order = 0;
+    int precision = LPC_PRECISION;
+    int shift = 0;
+    std::vector<int32_t> coefficients;  // coefficients[j] multiplies the sample j + 1 positions back
+};
+
+// Side information stored in the frame header for an LPC frame
+int lpcHeaderBits(const LpcParameters &lpc) { return 5 + 4 + 5 + lpc.order * lpc.precision; }
+
+void writeLpcParameters(BitStream &stream, const LpcParameters &lpc) {
+    stream.writeBits(lpc.order - 1, 5);
+    stream.writeBits(lpc.precision - 1, 4);
+    stream.writeBits(lpc.shift, 5);
+    for (int32_t coefficient : lpc.coefficients) {
+        stream.writeBits(static_cast<uint32_t>(coefficient) & ((1u << lpc.precision) - 1), lpc.precision);
+    }
+}
+
+void readLpcParameters(BitStream &stream, LpcParameters &lpc) {
+    lpc.order = stream.readBits(5) + 1;
+    lpc.precision = stream.readBits(4) + 1;
+    lpc.shift = stream.readBits(5);
+    lpc.coefficients.resize(lpc.order);
+    for (int j = 0; j < lpc.order; j++) {
+        int32_t value = stream.readBits(lpc.precision);
+        if (value >> (lpc.precision - 1)) value -= 1 << lpc.precision;  // Sign extend
+        lpc.coefficients[j] = value;
+    }
+}
+
+// Autocorrelation of one lane for lags 0..maxLag, accumulated into autoc
+void accumulateAutocorrelation(const std::vector<double> &x, int maxLag, double *autoc) {
+    const int n = x.size();
+    const double *data = x.data();
+    for (int lag = 0; lag <= maxLag && lag < n; lag++) {
+        double sum = 0;
+#pragma omp simd reduction(+ : sum)
+        for (int i = lag; i < n; i++) {
+            sum += data[i] * data[i - lag];
+        }
+        autoc[lag] += sum;
+    }
+}
+
+// Levinson-Durbin recursion. Fills coefficients[order - 1] with the predictor of each order up to maxOrder
+// and returns the highest order that could be computed (lower when the signal is fully predictable).
+int levinsonDurbin(const double *autoc, int maxOrder, std::vector<std::vector<double>> &coefficients) {
+    coefficients.assign(maxOrder, std::vector<double>());
+    std::vector<double> lpc(maxOrder, 0.0);
+    double error = autoc[0];
+    for (int i = 0; i < maxOrder; i++) {
+        if (error <= 0) return i;
+
+        double reflection = -autoc[i + 1];
+        for (int j = 0; j < i; j++) reflection -= lpc[j] * autoc[i - j];
+        reflection /= error;
+
+        lpc[i] = reflection;
+        for (int j = 0; j < i / 2; j++) {
+            double tmp = lpc[j];
+            lpc[j] += reflection * lpc[i - 1 - j];
+            lpc[i - 1 - j] += reflection * tmp;
+        }
+        if (i % 2) lpc[i / 2] += lpc[i / 2] * reflection;
+        error *= 1.0 - reflection * reflection;
+
+        coefficients[i].resize(i + 1);
+        for (int j = 0; j <= i; j++) coefficients[i][j] = -lpc[j];
+    }
+    return maxOrder;
+}
+
+// Quantize to `precision` bits with error feedback, choosing the largest shift that keeps every coefficient in range.
+// Fails when the coefficients are too large to be represented with a non-negative shift.
+bool quantizeLpcCoefficients(const std::vector<double> &coefficients, int precision, LpcParameters &lpc) {
+    double maxCoefficient = 0;
+    for (double c : coefficients) maxCoefficient = std::max(maxCoefficient, std::fabs(c));
+    if (maxCoefficient <= 0) return false;
+
+    int log2Max;
+    std::frexp(maxCoefficient, &log2Max);
+    int shift = (precision - 1) - log2Max;
+    if (shift < 0) return false;
+    shift = std::min(shift, LPC_MAX_SHIFT);
+
+    const int32_t maxValue = (1 << (precision - 1)) - 1;
+    const int32_t minValue = -(1 << (precision - 1));
+    lpc.order = coefficients.size();
+    lpc.precision = precision;
+    lpc.shift = shift;
+    lpc.coefficients.resize(lpc.order);
+    double error = 0;
+    for (int j = 0; j < lpc.order; j++) {
+        error += coefficients[j] * (double)(1LL << shift);
+        int32_t q = std::max(minValue, std::min(maxValue, (int32_t)std::lround(error)));
+        lpc.coefficients[j] = q;
+        error -= q;
+    }
+    return true;
+}
+
+// Filter kernel: prediction for the sample following history[0 .. order - 1] (oldest first),
+// reversedCoefficients[j] = coefficients[order - 1 - j] so both run forward in memory
+inline int32_t lpcPredict(const int32_t *history, const int32_t *reversedCoefficients, int order, int shift) {
+    int64_t sum = 0;
+#pragma omp simd reduction(+ : sum)
+    for (int j = 0; j < order; j++) {
+        sum += (int64_t)reversedCoefficients[j] * history[j];
+    }
+    return clampWorkSample(sum >> shift);
+}
+
+// Runs the LPC filter over one channel of a frame, shared by the encoder and the decoder.
+// Both sides predict from reconstructed samples, so lossy (q_bits > 0) frames stay in sync. The first `order`
+// samples of a channel are its warm-up, stored in the channel header.
+class LpcFilter {
+   private:
+    const LpcParameters &lpc;
+    std::vector<int32_t> reversed;
+    std::vector<int32_t> samples;  // Reconstructed samples of the channel so far
+
+   public:
+    LpcFilter(const LpcParameters &lpc, int laneLength)
+        : lpc(lpc), reversed(lpc.coefficients.rbegin(), lpc.coefficients.rend()) {
+        samples.reserve(laneLength);
+    }
+
+    int warmupLength() const { return lpc.order; }
+
+    // Prediction for the next sample, whose predecessors have all been pushed
+    int32_t predict() const {
+        const int n = samples.size();
+        if (n >= lpc.order) return lpcPredict(samples.data() + n - lpc.order, reversed.data(), lpc.order, lpc.shift);
+        return n == 0 ? 0 : samples[n - 1];
+    }
+
+    // Store the reconstructed value of the next sample (clamped to the working range) and return it
+    int32_t push(int32_t predicted, int32_t residual) {
+        int32_t sample = clampWorkSample((int64_t)predicted + residual);
+        samples.push_back(sample);
+        return sample;
+    }
+};
+
+// Quantized residuals of one channel under the given LPC parameters, following its warm-up samples
+void lpcResiduals(Span<const int32_t> channel, const LpcParameters &lpc, int q_bits, std::vector<int> &residuals) {
+    LpcFilter filter(lpc, channel.size());
+    const size_t warmup = pushWarmup(filter, channel);
+    residuals.resize(channel.size() - warmup);
+    for (size_t i = warmup; i < channel.size(); i++) {
+        int32_t predicted = filter.predict();
+        int residual = quantizeResidual(channel[i] - predicted, q_bits);
+        residuals[i - warmup] = residual;
+        filter.push(predicted, residual << q_bits);
+    }
+}
+
+// Orders whose cost is estimated, every one of them is too expensive to evaluate per frame
+const int LPC_CANDIDATE_ORDERS[] = {1, 2, 3, 4, 6, 8, 10, 12, 16, 20, 24, 32};
+const int LPC_CANDIDATE_COUNT = sizeof(LPC_CANDIDATE_ORDERS) / sizeof(LPC_CANDIDATE_ORDERS[0]);
+
+// Predictor coefficients of every order up to maxOrder for one channel, coefficients[order - 1] being those of
+// order. Returns the highest order computed, 0 when no LPC predictor applies (e.g. silence).
+int analyzeLpc(Span<const int32_t> channel, int maxOrder, std::vector<std::vector<double>> &coefficients) {
+    const int laneLength = channel.size();
+    maxOrder = std::min({maxOrder, LPC_MAX_ORDER, laneLength - 1});
+    if (maxOrder < 1) return 0;
+
+    // Windowed autocorrelation
+    const double pi = std::acos(-1.0);
+    std::vector<double> autoc(maxOrder + 1, 0.0);
+    std::vector<double> windowed(laneLength);
+    for (int n = 0; n < laneLength; n++) {
+        // Tukey (0.5) window, tapering the first and last quarter of the channel
+        double position = (n + 0.5) / laneLength;
+        double window = 1.0;
+        if (position < 0.25) window = 0.5 - 0.5 * std::cos(4 * pi * position);
+        if (position > 0.75) window = 0.5 - 0.5 * std::cos(4 * pi * (1 - position));
+        windowed[n] = channel[n] * window;
+    }
+    accumulateAutocorrelation(windowed, maxOrder, autoc.data());
+    if (autoc[0] == 0) return 0;
+    autoc[0] *= 1.0 + 1e-9;  // Keep the recursion stable on near-singular inputs
+
+    return levinsonDurbin(autoc.data(), maxOrder, coefficients);
+}
+
+// Cost of the LPC predictor with the given coefficients: residual bits (estimated with their partitioning) plus
+// coefficient side information and warm-up samples. Returns false when the coefficients cannot be quantized.
+bool evaluateLpc(Span<const int32_t> channel, const std::vector<double> &coefficients, int q_bits, bool useInterleaving,
+                 LpcParameters &lpc, std::vector<int> &residuals, uint64_t &bits) {
+    if (!quantizeLpcCoefficients(coefficients, LPC_PRECISION, lpc)) return false;
+    lpcResiduals(channel, lpc, q_bits, residuals);
+    RicePartitioning partitioning;
+    bits = estimatePartitioning(residuals, useInterleaving, partitioning) + lpcHeaderBits(lpc) + warmupBits(channel.subspan(0, std::min<size_t>(lpc.order, channel.size())));
+    return true;
+}
+
+#endif
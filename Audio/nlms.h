@@ -0,0 +1,225 @@
+#ifndef NLMS
+#define NLMS
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "./audio_utilities.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define NLMS_AVX2_KERNELS
+#endif
+
+// Backward-adaptive sign-sign LMS filters (in the style of Monkey's Audio) cascaded after the frame's fixed
+// predictor in high compression mode. Encoder and decoder adapt on the same reconstructed values, so the
+// filters need no side information. Integer arithmetic throughout, wrapping exactly like the SIMD kernels.
+// The kernels hold 16-bit stage inputs, which would saturate on wider samples and leave the cascade with next to
+// nothing to learn from, so channels of more than 16 significant bits keep a 32-bit history on a scalar path.
+
+// Dot product of two int16 vectors with 32-bit wrap-around accumulation (n multiple of 16)
+inline int32_t nlmsDotProductScalar(const int16_t *a, const int16_t *b, int n) {
+    uint32_t sum = 0;
+#pragma omp simd reduction(+ : sum)
+    for (int i = 0; i < n; i++) sum += (uint32_t)((int32_t)a[i] * b[i]);
+    return (int32_t)sum;
+}
+
+// weights -= direction * delta, wrapping at 16 bits
+inline void nlmsAdaptScalar(int16_t *weights, const int16_t *delta, int direction, int n) {
+    if (direction > 0) {
+#pragma omp simd
+        for (int i = 0; i < n; i++) weights[i] = (int16_t)(weights[i] - delta[i]);
+    } else if (direction < 0) {
+#pragma omp simd
+        for (int i = 0; i < n; i++) weights[i] = (int16_t)(weights[i] + delta[i]);
+    }
+}
+
+#ifdef NLMS_AVX2_KERNELS
+__attribute__((target("avx2"))) inline int32_t nlmsDotProductAvx2(const int16_t *a, const int16_t *b, int n) {
+    __m256i sum = _mm256_setzero_si256();
+    for (int i = 0; i < n; i += 16) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(va, vb));
+    }
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4E));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xB1));
+    return _mm_cvtsi128_si32(half);
+}
+
+__attribute__((target("avx2"))) inline void nlmsAdaptAvx2(int16_t *weights, const int16_t *delta, int direction, int n) {
+    if (direction == 0) return;
+    for (int i = 0; i < n; i += 16) {
+        __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(weights + i));
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(delta + i));
+        w = direction > 0 ? _mm256_sub_epi16(w, d) : _mm256_add_epi16(w, d);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(weights + i), w);
+    }
+}
+
+inline bool nlmsUseAvx2() {
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+#endif
+
+// Dot product of a 32-bit history with the weights, accumulated on 64 bits
+inline int64_t nlmsWideDotProduct(const int32_t *a, const int16_t *b, int n) {
+    int64_t sum = 0;
+#pragma omp simd reduction(+ : sum)
+    for (int i = 0; i < n; i++) sum += (int64_t)a[i] * b[i];
+    return sum;
+}
+
+inline int32_t nlmsDotProduct(const int16_t *a, const int16_t *b, int n) {
+#ifdef NLMS_AVX2_KERNELS
+    if (nlmsUseAvx2()) return nlmsDotProductAvx2(a, b, n);
+#endif
+    return nlmsDotProductScalar(a, b, n);
+}
+
+inline void nlmsAdapt(int16_t *weights, const int16_t *delta, int direction, int n) {
+#ifdef NLMS_AVX2_KERNELS
+    if (nlmsUseAvx2()) return nlmsAdaptAvx2(weights, delta, direction, n);
+#endif
+    nlmsAdaptScalar(weights, delta, direction, n);
+}
+
+// One filter stage. History and adaptation steps live in roll buffers so the last `order` values are
+// always contiguous for the kernels.
+class NlmsFilter {
+   private:
+    static const int WINDOW = 512;
+
+    int order;
+    int shift;
+    int runningAverage = 0;
+    bool wide;                    // Samples of more than 16 bits, the history is then wideInput
+    int position;                 // Next slot in the roll buffers, the history is [position - order, position)
+    std::vector<int16_t> weights;
+    std::vector<int16_t> input;   // Saturated stage inputs
+    std::vector<int32_t> wideInput;
+    std::vector<int16_t> delta;   // Adaptation step of each past input
+
+   public:
+    NlmsFilter(int order, int shift, bool wide)
+        : order(order),
+          shift(shift),
+          wide(wide),
+          position(order),
+          weights(order, 0),
+          input(wide ? 0 : order + WINDOW, 0),
+          wideInput(wide ? order + WINDOW : 0, 0),
+          delta(order + WINDOW, 0) {}
+
+    int32_t predict() const {
+        if (wide) {
+            const int64_t dot = nlmsWideDotProduct(&wideInput[position - order], weights.data(), order);
+            const int64_t prediction = (dot + (1 << (shift - 1))) >> shift;
+            return (int32_t)std::max<int64_t>(INT32_MIN, std::min<int64_t>(INT32_MAX, prediction));
+        }
+        int32_t dot = nlmsDotProduct(&input[position - order], weights.data(), order);
+        return (dot + (1 << (shift - 1))) >> shift;
+    }
+
+    // Adapt towards the stage output (the prediction error) and append the stage input to the history
+    void update(int32_t stageInput, int32_t stageOutput) {
+        nlmsAdapt(weights.data(), &delta[position - order], stageOutput > 0 ? -1 : (stageOutput < 0 ? 1 : 0), order);
+
+        // Larger steps for inputs that stand out from the recent average, opposite to the input's sign
+        int magnitude = std::abs(stageInput);
+        int step = 0;
+        if (magnitude > runningAverage * 3) {
+            step = 32;
+        } else if (magnitude > (runningAverage * 4) / 3) {
+            step = 16;
+        } else if (magnitude > 0) {
+            step = 8;
+        }
+        delta[position] = stageInput < 0 ? -step : step;
+        runningAverage += (magnitude - runningAverage) / 16;
+
+        // Older steps decay
+        delta[position - 1] >>= 1;
+        delta[position - 2] >>= 1;
+        delta[position - 8] >>= 1;
+
+        if (wide) {
+            wideInput[position] = stageInput;
+        } else {
+            input[position] = (int16_t)std::max(-32768, std::min(32767, stageInput));
+        }
+        if (++position == (int)delta.size()) {
+            if (wide) {
+                std::memmove(wideInput.data(), &wideInput[WINDOW], order * sizeof(int32_t));
+            } else {
+                std::memmove(input.data(), &input[WINDOW], order * sizeof(int16_t));
+            }
+            std::memmove(delta.data(), &delta[WINDOW], order * sizeof(int16_t));
+            position = order;
+        }
+    }
+};
+
+// Cascade of 256, 32 and 16 tap filters over one channel, each one predicting the previous stage's error
+class NlmsCascade {
+   private:
+    std::vector<NlmsFilter> stages;
+    std::vector<int32_t> predictions;  // Last prediction of each stage
+
+   public:
+    // sampleBits: significant bits of the channel's samples
+    explicit NlmsCascade(int sampleBits) {
+        const bool wide = sampleBits > 16;
+        stages.emplace_back(256, 13, wide);
+        stages.emplace_back(32, 10, wide);
+        stages.emplace_back(16, 11, wide);
+        predictions.resize(stages.size());
+    }
+
+    // Sum of the stage predictions for the next sample, has to be followed by update()
+    int32_t predict() {
+        int32_t total = 0;
+        for (size_t stage = 0; stage < stages.size(); stage++) {
+            predictions[stage] = stages[stage].predict();
+            total += predictions[stage];
+        }
+        return total;
+    }
+
+    // Feed the reconstructed output of the last stage. Unwinds the stages, adapting each one,
+    // and returns the reconstructed input of the first stage (the fixed predictor's residual).
+    int32_t update(int32_t output) {
+        for (int stage = stages.size() - 1; stage >= 0; stage--) {
+            int32_t stageInput = output + predictions[stage];
+            stages[stage].update(stageInput, output);
+            output = stageInput;
+        }
+        return output;
+    }
+};
+
+// Encoder side: quantized residuals of one channel through a fixed predictor (TaylorFilter or LpcFilter)
+// followed by the cascade, predicting from reconstructed values like the decoder. The cascade starts after the
+// fixed predictor's warm-up samples.
+template <typename Filter>
+void nlmsResiduals(Span<const int32_t> channel, int sampleBits, Filter &filter, int q_bits,
+                   std::vector<int> &residuals) {
+    NlmsCascade cascade(sampleBits);
+    const size_t warmup = pushWarmup(filter, channel);
+    residuals.resize(channel.size() - warmup);
+    for (size_t i = warmup; i < channel.size(); i++) {
+        int32_t predicted = filter.predict();
+        int32_t cascadePrediction = cascade.predict();
+        int residual = quantizeResidual(channel[i] - predicted - cascadePrediction, q_bits);
+        residuals[i - warmup] = residual;
+        filter.push(predicted, cascade.update(residual << q_bits));
+    }
+}
+
+#endif
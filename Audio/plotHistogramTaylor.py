@@ -1,13 +1,16 @@
+import sys
+
 import pandas as pd
 import matplotlib.pyplot as plt
 
 def plot_csv_histogram(filename):
-    # Read CSV file with a single column
-    data = pd.read_csv(filename, header=None, names=['value'])
+    # Read the per-channel rows written by encode --stats <file>.csv, keeping the Taylor-coded channels
+    data = pd.read_csv(filename)
+    degrees = data.loc[data['taylor_degree'] >= 0, 'taylor_degree']
     
     # Create the histogram
     plt.figure(figsize=(10, 6))
-    plt.hist(data['value'], bins=30, edgecolor='black', color='blue', alpha=0.7)
+    plt.hist(degrees, bins=30, edgecolor='black', color='blue', alpha=0.7)
     
     # Customize the plot
     plt.xlabel('Predictor Degree')
@@ -19,5 +22,4 @@ def plot_csv_histogram(filename):
     plt.show()
 
 if __name__ == "__main__":
-    # Replace 'your_file.csv' with your actual CSV filename
-    plot_csv_histogram('taylor_degrees.csv')
\ No newline at end of file
+    plot_csv_histogram(sys.argv[1] if len(sys.argv) > 1 else 'stats.csv')
@@ -0,0 +1,88 @@
+#ifndef RATECONTROL
+#define RATECONTROL
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "./blocksize.h"
+#include "./stereo.h"
+
+// One-pass rate control for lossy encoding. Before a frame is coded its size is estimated for every q_bits from
+// the residual statistics of its channels, and the finest quantization that fits a leaky bucket (VBV) model of
+// the target bitrate is used. The bucket fills with each frame's bits and drains at the target rate, its level
+// is steered towards half full, and a frame never gets more bits than would overflow it. Quantization is never
+// coarser than the frame's signal allows (see qualityLimit): targets too low for that are exceeded instead, and the
+// frames that did so are counted.
+class RateController {
+   private:
+    static constexpr double SMOOTHING_FRAMES = 8;  // Frames over which a bucket level error is corrected
+
+    int maxQBits;
+    double bitsPerSample;    // Target bits per interleaved sample
+    double capacity;         // Bucket size in bits
+    double fullness = 0;
+    double correction = 1;   // Measured over estimated bits, smoothed over recent frames
+    int limitedFrames = 0;   // Frames that got more bits than the target for the sake of their quality limit
+
+   public:
+    RateController(int targetKbps, unsigned int sampleRate, unsigned int channelCount, int bufferMilliseconds, int maxQBits)
+        : maxQBits(maxQBits),
+          bitsPerSample(targetKbps * 1000.0 / ((double)sampleRate * channelCount)),
+          capacity(targetKbps * (double)bufferMilliseconds) {
+        fullness = capacity / 2;
+    }
+
+    // Estimated bits of a frame for each q_bits from 0 to maxQBits. The fixed predictor residual sum of every
+    // channel scales down by 2^q_bits, each channel costing about 2 + log2(1 + mean) bits per sample.
+    std::vector<double> estimateFrameBits(const std::vector<std::vector<int32_t>> &channels) const {
+        std::vector<double> bits(maxQBits + 1, FRAME_OVERHEAD_BITS);
+        for (const auto &channel : channels) {
+            const int n = channel.size();
+            const double mean = n ? (double)fixedResidualSum(channel.data(), n) / n : 0;
+            for (int q = 0; q <= maxQBits; q++) {
+                bits[q] += CHANNEL_OVERHEAD_BITS + n * (2 + std::log2(1 + std::ldexp(mean, -q)));
+            }
+        }
+        return bits;
+    }
+
+    // Coarsest q_bits whose quantization noise, a rounding error spread over a step of 2^q_bits, stays below the mean
+    // power of the frame's samples. Any coarser and the frame decodes to more noise than signal.
+    int qualityLimit(const std::vector<std::vector<int32_t>> &channels) const {
+        double power = 0;
+        size_t n = 0;
+        for (const auto &channel : channels) {
+            for (int32_t sample : channel) power += (double)sample * sample;
+            n += channel.size();
+        }
+        if (n) power /= n;
+        int q = 0;
+        while (q < maxQBits && std::ldexp(1.0, 2 * (q + 1)) / 12 <= power) q++;
+        return q;
+    }
+
+    // Finest q_bits whose (corrected) estimate fits the bits the bucket can give this frame, at most maxQ
+    int chooseQBits(const std::vector<double> &estimatedBits, size_t frameSamples, int maxQ) {
+        const double drain = bitsPerSample * frameSamples;
+        const double budget = drain + (capacity / 2 - fullness) / SMOOTHING_FRAMES;
+        const double limit = capacity - fullness + drain;  // Overflow
+        const double allowed = std::min(budget, limit);
+        for (int q = 0; q <= maxQ; q++) {
+            if (estimatedBits[q] * correction <= allowed) return q;
+        }
+        if (maxQ < maxQBits) limitedFrames++;
+        return maxQ;
+    }
+
+    int getLimitedFrames() const { return limitedFrames; }
+
+    // Account for the frame actually written, a bucket overflowing for the sake of quality is only counted full
+    void update(double estimatedBits, uint64_t actualBits, size_t frameSamples) {
+        fullness = std::min(capacity, std::max(0.0, fullness + actualBits - bitsPerSample * frameSamples));
+        if (estimatedBits > 0) correction = 0.8 * correction + 0.2 * (actualBits / estimatedBits);
+    }
+};
+
+#endif
@@ -0,0 +1,200 @@
+#ifndef RICE
+#define RICE
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../Common/bitStream.h"
+#include "../Common/golomb.h"
+
+// Partitioned residual coding, FLAC style. A channel's residuals are split into 2^order partitions of (nearly)
+// equal length, each coded with its own Golomb parameter, so a transient only inflates the codes of the partition
+// it falls in. Parameters are Rice-like but step by half a bit: index 2k is m = 2^k and index 2k + 1 is
+// m = 3 * 2^(k - 1), which recovers most of what power-of-two parameters lose against the best m.
+const int RICE_ORDER_BITS = 4;
+const int RICE_PARAMETER_BITS = 6;
+const int RICE_MAX_ORDER = 8;
+const int RICE_MIN_PARTITION = 16;  // Samples per partition, finer splits cost more in parameters than they save
+const int RICE_MIN_PARAMETER = 2;   // m = 2, the Golomb coder needs m > 1
+const int RICE_MAX_PARAMETER = 58;  // m = 2^29
+
+inline int riceM(int parameter) { return (2 + (parameter & 1)) << ((parameter >> 1) - 1); }
+
+struct RicePartitioning {
+    int order = 0;
+    std::vector<int> parameters;  // Parameter index of each partition
+};
+
+// First residual of partition j out of 2^order over n residuals. Boundaries of a coarser order are boundaries of
+// every finer one, which lets partition sums be merged bottom-up.
+inline size_t partitionStart(size_t n, int order, size_t j) { return (j * n) >> order; }
+
+// Golomb::encode remainder bits: the truncated binary code spends b - 1 bits on the first 2^b - m remainders
+inline void remainderCode(int m, int &b, int &threshold) {
+    b = 0;
+    while ((1 << b) < m) b++;
+    threshold = (1 << b) - m;
+}
+
+// Estimated Golomb::encode bits of n values (magnitudes, or zigzag codes with interleaving) adding up to sum:
+// unary terminator and sign bit per value, remainders taken as uniform, and the quotients, whose floor drops
+// about (m - 1) / 2 per value
+inline uint64_t riceBits(uint64_t sum, uint64_t n, int parameter, bool useInterleaving) {
+    const int m = riceM(parameter);
+    int b, threshold;
+    remainderCode(m, b, threshold);
+    uint64_t dropped = n * (m - 1) / 2;
+    uint64_t quotients = sum > dropped ? (sum - dropped) / m : 0;
+    return n * (b + (useInterleaving ? 1 : 2)) - n * threshold / m + quotients;
+}
+
+// Cheapest parameter for a partition, returns its estimated bits through bits
+inline int bestRiceParameter(uint64_t sum, uint64_t n, bool useInterleaving, uint64_t &bits) {
+    int best = RICE_MIN_PARAMETER;
+    bits = riceBits(sum, n, best, useInterleaving);
+    for (int parameter = best + 1; parameter <= RICE_MAX_PARAMETER; parameter++) {
+        uint64_t candidate = riceBits(sum, n, parameter, useInterleaving);
+        if (candidate > bits) break;  // The estimate is convex in the parameter
+        best = parameter;
+        bits = candidate;
+    }
+    return best;
+}
+
+// Choose the partition order and parameters from the partition sums of the finest order, merging adjacent
+// partitions pair by pair for each coarser order, so the residuals are read only once.
+// Returns the estimated bits of the residuals including the partitioning side information.
+uint64_t estimatePartitioning(const std::vector<int> &residuals, bool useInterleaving, RicePartitioning &best) {
+    const size_t n = residuals.size();
+    int maxOrder = 0;
+    while (maxOrder < RICE_MAX_ORDER && (n >> (maxOrder + 1)) >= (size_t)RICE_MIN_PARTITION) maxOrder++;
+
+    // Sums of the coded magnitudes over the finest partitions
+    std::vector<uint64_t> sums(size_t(1) << maxOrder);
+    std::vector<uint64_t> counts(sums.size());
+    for (size_t j = 0; j < sums.size(); j++) {
+        const size_t start = partitionStart(n, maxOrder, j);
+        const size_t end = partitionStart(n, maxOrder, j + 1);
+        uint64_t sum = 0;
+#pragma omp simd reduction(+ : sum)
+        for (size_t i = start; i < end; i++) {
+            int residual = residuals[i];
+            sum += useInterleaving ? (residual >= 0 ? 2 * residual : -2 * residual - 1) : std::abs(residual);
+        }
+        sums[j] = sum;
+        counts[j] = end - start;
+    }
+
+    uint64_t bestBits = UINT64_MAX;
+    std::vector<int> parameters;
+    for (int order = maxOrder;; order--) {
+        uint64_t bits = RICE_ORDER_BITS;
+        parameters.resize(sums.size());
+        for (size_t j = 0; j < sums.size(); j++) {
+            uint64_t partitionBits;
+            parameters[j] = bestRiceParameter(sums[j], counts[j], useInterleaving, partitionBits);
+            bits += RICE_PARAMETER_BITS + partitionBits;
+        }
+        if (bits <= bestBits) {  // Ties go to the coarser order
+            bestBits = bits;
+            best.order = order;
+            best.parameters = parameters;
+        }
+        if (order == 0) break;
+
+        // Merge pairs into the next coarser order
+        for (size_t j = 0; j < sums.size() / 2; j++) {
+            sums[j] = sums[2 * j] + sums[2 * j + 1];
+            counts[j] = counts[2 * j] + counts[2 * j + 1];
+        }
+        sums.resize(sums.size() / 2);
+        counts.resize(counts.size() / 2);
+    }
+    return bestBits;
+}
+
+// Exact Golomb::encode bits of residuals [start, end) with a parameter whose m is base << shift. The quotient is
+// the value shifted then divided by the constant base, which compiles to a multiply instead of a division by m.
+template <int base>
+uint64_t exactRiceBits(const std::vector<int> &residuals, size_t start, size_t end, int parameter,
+                       bool useInterleaving) {
+    const int shift = (parameter >> 1) - 1;
+    const int m = base << shift;
+    int b, threshold;
+    remainderCode(m, b, threshold);
+    uint64_t total = (end - start) * (useInterleaving ? 1 : 2);
+#pragma omp simd reduction(+ : total)
+    for (size_t i = start; i < end; i++) {
+        int residual = residuals[i];
+        int value = useInterleaving ? (residual >= 0 ? 2 * residual : -2 * residual - 1) : std::abs(residual);
+        int quotient = (value >> shift) / base;
+        total += quotient + (value - quotient * m < threshold ? b - 1 : b);
+    }
+    return total;
+}
+
+// Partition as estimatePartitioning does, then settle each partition of the chosen order on its exact cost since
+// the estimate can be a parameter off. Returns the exact bits of the residuals including the side information.
+uint64_t choosePartitioning(const std::vector<int> &residuals, bool useInterleaving, RicePartitioning &best) {
+    estimatePartitioning(residuals, useInterleaving, best);
+    const size_t n = residuals.size();
+    uint64_t bestBits = RICE_ORDER_BITS;
+    for (size_t j = 0; j < best.parameters.size(); j++) {
+        const size_t start = partitionStart(n, best.order, j);
+        const size_t end = partitionStart(n, best.order, j + 1);
+        auto exactBits = [&](int parameter) {
+            return parameter & 1 ? exactRiceBits<3>(residuals, start, end, parameter, useInterleaving)
+                                 : exactRiceBits<2>(residuals, start, end, parameter, useInterleaving);
+        };
+        int &parameter = best.parameters[j];
+        uint64_t bits = exactBits(parameter);
+        for (int direction = -1; direction <= 1; direction += 2) {
+            while (parameter + direction >= RICE_MIN_PARAMETER && parameter + direction <= RICE_MAX_PARAMETER) {
+                uint64_t candidate = exactBits(parameter + direction);
+                if (candidate >= bits) break;
+                bits = candidate;
+                parameter += direction;
+            }
+        }
+        bestBits += RICE_PARAMETER_BITS + bits;
+    }
+    return bestBits;
+}
+
+// Write the partitioning and the residuals, returns the bits written
+int writePartitionedResiduals(BitStream &stream, const std::vector<int> &residuals, const RicePartitioning &partitioning,
+                              bool useInterleaving) {
+    int bits_written = RICE_ORDER_BITS;
+    stream.writeBits(partitioning.order, RICE_ORDER_BITS);
+    for (size_t j = 0; j < partitioning.parameters.size(); j++) {
+        stream.writeBits(partitioning.parameters[j], RICE_PARAMETER_BITS);
+        bits_written += RICE_PARAMETER_BITS;
+        Golomb golomb(riceM(partitioning.parameters[j]), useInterleaving);
+        const size_t end = partitionStart(residuals.size(), partitioning.order, j + 1);
+        for (size_t i = partitionStart(residuals.size(), partitioning.order, j); i < end; i++) {
+            bits_written += golomb.encode(stream, residuals[i]);
+        }
+    }
+    return bits_written;
+}
+
+// Read partitioned residuals, calling consume(residual) for each one in order. Parameters no encoder writes throw
+// std::runtime_error.
+template <typename Consumer>
+void readPartitionedResiduals(BitStream &stream, size_t n, bool useInterleaving, Consumer consume) {
+    const int order = stream.readBits(RICE_ORDER_BITS);
+    for (size_t j = 0; j < (size_t(1) << order); j++) {
+        const int parameter = stream.readBits(RICE_PARAMETER_BITS);
+        if (parameter < RICE_MIN_PARAMETER || parameter > RICE_MAX_PARAMETER) {
+            throw std::runtime_error("Invalid Rice parameter " + std::to_string(parameter));
+        }
+        Golomb golomb(riceM(parameter), useInterleaving);
+        const size_t end = partitionStart(n, order, j + 1);
+        for (size_t i = partitionStart(n, order, j); i < end; i++) consume(golomb.decode(stream));
+    }
+}
+
+#endif
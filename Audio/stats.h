@@ -0,0 +1,117 @@
+#ifndef STATS
+#define STATS
+
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Encoder instrumentation for --stats: wall time and call count of each stage, and the decisions taken for every
+// channel of every frame, all kept in memory and written once at the end. Encoding without stats passes a null
+// EncoderStats pointer, which every probe checks before reading the clock, so the instrumentation costs nothing.
+enum EncoderStage {
+    STAGE_LOAD,       // Reading the input, wasted bits and deinterleaving
+    STAGE_SEARCH,     // Stereo decision, rate control and predictor search
+    STAGE_PARTITION,  // Golomb parameter (m) selection of the winning residuals, after any adaptive refinement
+    STAGE_EMIT,       // Golomb coding of the frame, and its lossy decoding in hybrid mode
+    STAGE_OUTPUT,     // Writing the coded frames out
+    STAGE_COUNT
+};
+
+const char *const STAGE_NAMES[STAGE_COUNT] = {"load", "search", "partition", "emit", "output"};
+
+// Coding of one channel of one frame
+struct ChannelStats {
+    uint32_t frame = 0;
+    int channel = 0;
+    int samples = 0;
+    int q_bits = 0;
+    int shift = 0;        // Wasted bits of the frame
+    int stereo_mode = 0;
+    const char *predictor = "";
+    int taylor_degree = -1;  // -1 unless the Taylor predictor was used
+    int lpc_order = 0;       // 0 unless LPC was used
+    int rice_order = -1;     // Partition order, -1 for constant and verbatim channels
+    int m_min = 0, m_max = 0;  // Golomb parameters over the partitions
+    uint64_t bits = 0;         // Channel size in the stream
+};
+
+class EncoderStats {
+   private:
+    double seconds[STAGE_COUNT] = {};
+    uint64_t calls[STAGE_COUNT] = {};
+
+   public:
+    std::vector<ChannelStats> channels;
+    uint32_t frames = 0;
+    uint64_t frameBits = 0;  // Frames with their length prefixes
+
+    void add(EncoderStage stage, double elapsed) {
+        seconds[stage] += elapsed;
+        calls[stage]++;
+    }
+
+    // Stage times as a table
+    void printStages(std::ostream &out) const {
+        double total = 0;
+        for (double s : seconds) total += s;
+        out << "Stage         Seconds    Share    Calls\n";
+        for (int stage = 0; stage < STAGE_COUNT; stage++) {
+            out << std::left << std::setw(10) << STAGE_NAMES[stage] << std::right << std::fixed << std::setprecision(4)
+                << std::setw(11) << seconds[stage] << std::setprecision(1) << std::setw(8)
+                << (total > 0 ? 100 * seconds[stage] / total : 0) << "%" << std::setw(9) << calls[stage] << '\n';
+        }
+        out << "Frames: " << frames << ", " << (frameBits + 7) / 8 << " bytes" << std::endl;
+    }
+
+    // One row per channel of each frame
+    void writeCsv(std::ostream &out) const {
+        out << "frame,channel,samples,q_bits,shift,stereo_mode,predictor,taylor_degree,lpc_order,rice_order,m_min,"
+               "m_max,bits\n";
+        for (const ChannelStats &c : channels) {
+            out << c.frame << ',' << c.channel << ',' << c.samples << ',' << c.q_bits << ',' << c.shift << ','
+                << c.stereo_mode << ',' << c.predictor << ',' << c.taylor_degree << ',' << c.lpc_order << ','
+                << c.rice_order << ',' << c.m_min << ',' << c.m_max << ',' << c.bits << '\n';
+        }
+    }
+
+    // Stage times and the channel rows
+    void writeJson(std::ostream &out) const {
+        out << "{\n  \"stages\": {";
+        for (int stage = 0; stage < STAGE_COUNT; stage++) {
+            out << (stage ? ", " : "") << '"' << STAGE_NAMES[stage] << "\": {\"seconds\": " << seconds[stage]
+                << ", \"calls\": " << calls[stage] << '}';
+        }
+        out << "},\n  \"frames\": " << frames << ",\n  \"frame_bits\": " << frameBits << ",\n  \"channels\": [";
+        for (size_t i = 0; i < channels.size(); i++) {
+            const ChannelStats &c = channels[i];
+            out << (i ? ",\n    " : "\n    ") << "{\"frame\": " << c.frame << ", \"channel\": " << c.channel
+                << ", \"samples\": " << c.samples << ", \"q_bits\": " << c.q_bits << ", \"shift\": " << c.shift
+                << ", \"stereo_mode\": " << c.stereo_mode << ", \"predictor\": \"" << c.predictor
+                << "\", \"taylor_degree\": " << c.taylor_degree << ", \"lpc_order\": " << c.lpc_order
+                << ", \"rice_order\": " << c.rice_order << ", \"m_min\": " << c.m_min << ", \"m_max\": " << c.m_max
+                << ", \"bits\": " << c.bits << '}';
+        }
+        out << "\n  ]\n}\n";
+    }
+};
+
+// Adds the time until it goes out of scope to a stage, does nothing without stats
+class StageTimer {
+   private:
+    EncoderStats *stats;
+    EncoderStage stage;
+    std::chrono::steady_clock::time_point start;
+
+   public:
+    StageTimer(EncoderStats *stats, EncoderStage stage) : stats(stats), stage(stage) {
+        if (stats) start = std::chrono::steady_clock::now();
+    }
+    ~StageTimer() {
+        if (stats) stats->add(stage, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+};
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef STEREO
+#define STEREO
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "./audio_utilities.h"
+
+// Inter-channel decorrelation of stereo frames, FLAC style. Each frame picks how its two channels are coded:
+//   independent  L, R
+//   left/side    L, S = L - R
+//   right/side   S, R
+//   mid/side     M = (L + R) >> 1, S   (L + R and S share their parity, so the dropped bit is recovered from S)
+// The transform runs in place on the deinterleaved channels, which are then predicted like any other channel.
+enum StereoMode { STEREO_INDEPENDENT = 0, STEREO_LEFT_SIDE = 1, STEREO_RIGHT_SIDE = 2, STEREO_MID_SIDE = 3 };
+const int STEREO_MODE_BITS = 2;
+
+// Channels coded by each mode, as indices into {left, right, mid, side}
+const int STEREO_CHANNELS[4][2] = {{0, 1}, {0, 3}, {3, 1}, {2, 3}};
+
+// Smallest sum of absolute residuals over the fixed polynomial predictors of order 0 to 3,
+// a cheap stand-in for the residual size of a channel
+inline int64_t fixedResidualSum(const int32_t *data, int n) {
+    int64_t sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+#pragma omp simd reduction(+ : sum0, sum1, sum2, sum3)
+    for (int i = 3; i < n; i++) {
+        int32_t e0 = data[i];
+        int32_t e1 = e0 - data[i - 1];
+        int32_t e2 = e1 - (data[i - 1] - data[i - 2]);
+        int32_t e3 = e2 - (data[i - 1] - 2 * data[i - 2] + data[i - 3]);
+        sum0 += e0 < 0 ? -e0 : e0;
+        sum1 += e1 < 0 ? -e1 : e1;
+        sum2 += e2 < 0 ? -e2 : e2;
+        sum3 += e3 < 0 ? -e3 : e3;
+    }
+    return std::min(std::min(sum0, sum1), std::min(sum2, sum3));
+}
+
+// Approximate Golomb bits of n residuals whose absolute values add up to sum
+inline double estimatedChannelBits(int64_t sum, int n) {
+    if (n <= 0) return 0;
+    return n * (1.0 + std::log2(1.0 + (double)sum / n));
+}
+
+// Pick the stereo mode whose channels look cheapest to code, each channel having its own Golomb parameter
+StereoMode chooseStereoMode(const std::vector<int32_t> &left, const std::vector<int32_t> &right) {
+    const int n = std::min(left.size(), right.size());
+    std::vector<int32_t> mid(n), side(n);
+    const int32_t *l = left.data();
+    const int32_t *r = right.data();
+#pragma omp simd
+    for (int i = 0; i < n; i++) {
+        mid[i] = (l[i] + r[i]) >> 1;
+        side[i] = l[i] - r[i];
+    }
+
+    const double leftBits = estimatedChannelBits(fixedResidualSum(l, n), n);
+    const double rightBits = estimatedChannelBits(fixedResidualSum(r, n), n);
+    const double midBits = estimatedChannelBits(fixedResidualSum(mid.data(), n), n);
+    const double sideBits = estimatedChannelBits(fixedResidualSum(side.data(), n), n);
+    const double costs[] = {leftBits + rightBits, leftBits + sideBits, sideBits + rightBits, midBits + sideBits};
+
+    StereoMode best = STEREO_INDEPENDENT;
+    for (int mode = STEREO_LEFT_SIDE; mode <= STEREO_MID_SIDE; mode++) {
+        if (costs[mode] < costs[best]) best = (StereoMode)mode;
+    }
+    return best;
+}
+
+// Transform a left/right pair in place. A trailing sample without a partner (odd-length input) is kept as is.
+void applyStereoMode(StereoMode mode, std::vector<int32_t> &first, std::vector<int32_t> &second) {
+    if (mode == STEREO_INDEPENDENT) return;
+    const int n = std::min(first.size(), second.size());
+    int32_t *a = first.data();
+    int32_t *b = second.data();
+#pragma omp simd
+    for (int i = 0; i < n; i++) {
+        int32_t l = a[i];
+        int32_t r = b[i];
+        int32_t s = l - r;
+        a[i] = mode == STEREO_LEFT_SIDE ? l : (mode == STEREO_RIGHT_SIDE ? s : (l + r) >> 1);
+        b[i] = mode == STEREO_RIGHT_SIDE ? r : s;
+    }
+}
+
+// Undo applyStereoMode in place
+void undoStereoMode(StereoMode mode, std::vector<int32_t> &first, std::vector<int32_t> &second) {
+    if (mode == STEREO_INDEPENDENT) return;
+    const int n = std::min(first.size(), second.size());
+    int32_t *a = first.data();
+    int32_t *b = second.data();
+#pragma omp simd
+    for (int i = 0; i < n; i++) {
+        int32_t x = a[i];
+        int32_t s = b[i];
+        int32_t sum = 2 * x + (s & 1);  // L + R when x is the mid channel
+        a[i] = mode == STEREO_LEFT_SIDE ? x : (mode == STEREO_RIGHT_SIDE ? x + s : (sum + s) >> 1);
+        b[i] = mode == STEREO_LEFT_SIDE ? x - s : (mode == STEREO_RIGHT_SIDE ? s : (sum - s) >> 1);
+    }
+}
+
+#endif
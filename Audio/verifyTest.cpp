@@ -0,0 +1,392 @@
+// Regression checks of verify mode on damaged streams: a silent stereo file is encoded in memory, then verified
+// intact and with the block size code of its first frame damaged, which must be reported as CORRUPT instead of
+// overrunning the decoder's frame buffer. A mono sine has the first Rice parameter of its frame damaged the same
+// way. The encoder must also refuse a Taylor degree it has no predictor for.
+// Round trips then check that coding paths the datasets may never reach decode exactly, each on a short synthetic
+// signal encoded and decoded in memory: the multi-threaded decoder's frame index, every stereo mode, frame sizes
+// chosen per region, constant and verbatim channels, wasted low bits, channels as short as their warm-up, every
+// sample format, and hybrid coding's correction.
+// Returns non-zero when a check fails.
+//
+//   verifyTest
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "./decoder.h"
+#include "./encoder.h"
+
+// Verify a stream written to a temporary file, returning the status and the line printed
+int verifyBytes(const std::string &bytes, std::string &line) {
+    const std::filesystem::path path = std::filesystem::temp_directory_path() / "verifyTest.g7a";
+    std::ofstream(path, std::ios::out | std::ios::binary).write(bytes.data(), bytes.size());
+    std::ostringstream captured;
+    std::streambuf *console = std::cout.rdbuf(captured.rdbuf());
+    const int status = verify(path.string());
+    std::cout.rdbuf(console);
+    std::filesystem::remove(path);
+    line = captured.str();
+    return status;
+}
+
+bool check(bool condition, const std::string &name, const std::string &line) {
+    std::cout << (condition ? "PASS " : "FAIL ") << name << ": " << line << (line.empty() ? "\n" : "");
+    return condition;
+}
+
+// Interleaved PCM of format whose sample i is value(i), in the format's integer units or in [-1, 1] for float
+std::vector<unsigned char> makePcm(int format, size_t count, const std::function<double(size_t)> &value) {
+    const int width = pcmBytes(format);
+    std::vector<unsigned char> pcm(count * width);
+    for (size_t i = 0; i < count; i++) {
+        unsigned char *p = &pcm[i * width];
+        if (format == PCM_FLOAT) {
+            const float sample = value(i);
+            uint32_t bits;
+            std::memcpy(&bits, &sample, sizeof bits);
+            PcmFormat<32>::store(p, bits);
+        } else if (format == 32) {
+            PcmFormat<32>::store(p, (int32_t)std::llround(value(i)));
+        } else {
+            withPcmFormat(format, [&](auto pcmFormat) { decltype(pcmFormat)::store(p, std::lround(value(i))); });
+        }
+    }
+    return pcm;
+}
+
+// Deterministic noise in [-1, 1)
+double noise(size_t i) {
+    uint32_t x = (uint32_t)i * 2654435761u;
+    x ^= x >> 15;
+    x *= 2246822519u;
+    x ^= x >> 13;
+    return x / 2147483648.0 - 1;
+}
+
+// Encode interleaved PCM in memory, collecting the encoder's per-channel decisions into stats when given.
+// taylor_degree fixes the predictor like encode lossless <degree>.
+std::string encodeBytes(const std::vector<unsigned char> &pcm, unsigned int channels, int format,
+                        const CodecOptions &options = CodecOptions(), EncoderStats *stats = nullptr,
+                        int taylor_degree = -1) {
+    const size_t count = pcm.size() / pcmBytes(format);
+    AudioEncoder encoder(channels, 44100, format, false, 0, taylor_degree, options, count);
+    encoder.setStats(stats);
+    encoder.pushSamples(PcmSpan(pcm.data(), count, pcmBytes(format)));
+    encoder.finish();
+    return encoder.pullBytes();
+}
+
+// Decode a stream in memory, empty unless it decodes to its end
+std::vector<unsigned char> decodeBytes(const std::string &bytes) {
+    AudioDecoder decoder;
+    try {
+        decoder.pushBytes(bytes.data(), bytes.size());
+    } catch (const std::exception &) {
+        return {};
+    }
+    return decoder.isFinished() ? decoder.pullSamples() : std::vector<unsigned char>();
+}
+
+// Encode and decode pcm in memory, checking that it comes back exactly
+bool checkRoundTrip(const std::string &name, const std::vector<unsigned char> &pcm, unsigned int channels, int format,
+                    const CodecOptions &options = CodecOptions(), EncoderStats *stats = nullptr) {
+    const std::string bytes = encodeBytes(pcm, channels, format, options, stats);
+    const bool exact = decodeBytes(bytes) == pcm;
+    return check(exact, name, std::to_string(bytes.size()) + " bytes, " + (exact ? "exact\n" : "decoded samples differ\n"));
+}
+
+// Decode a stream through files with decode() under options, empty when it fails. A correction stream is applied
+// when given.
+std::vector<unsigned char> decodeFile(const std::string &bytes, CodecOptions options,
+                                      const std::string &correction = "") {
+    const std::filesystem::path directory = std::filesystem::temp_directory_path();
+    const std::filesystem::path path = directory / "verifyTest.g7a", output = directory / "verifyTest.raw";
+    std::ofstream(path, std::ios::out | std::ios::binary).write(bytes.data(), bytes.size());
+    if (!correction.empty()) {
+        options.correction_path = (directory / "verifyTest.corr").string();
+        std::ofstream(options.correction_path, std::ios::out | std::ios::binary)
+            .write(correction.data(), correction.size());
+    }
+    options.raw_output = true;
+    options.output_path = output.string();
+    options.quiet = true;
+    const int status = decode(path.string(), options);
+    std::ifstream decodedFile(output, std::ios::in | std::ios::binary);
+    std::vector<unsigned char> decoded((std::istreambuf_iterator<char>(decodedFile)), std::istreambuf_iterator<char>());
+    decodedFile.close();
+    std::filesystem::remove(path);
+    std::filesystem::remove(output);
+    if (!correction.empty()) std::filesystem::remove(options.correction_path);
+    return status == 0 ? decoded : std::vector<unsigned char>();
+}
+
+// The multi-threaded decoder indexes frames by their length prefixes and decodes runs of them on each worker
+bool checkParallelDecode() {
+    const unsigned int channels = 2;
+    const size_t count = (size_t)channelFrameSize(CodecOptions()) * channels * 40;  // Runs of 16 frames
+    const std::vector<unsigned char> pcm = makePcm(16, count, [](size_t i) {
+        return 8000 * std::sin(i / 2 * 0.01 + i % 2) + 200 * noise(i);
+    });
+    const std::string bytes = encodeBytes(pcm, channels, 16);
+    CodecOptions options;
+    options.threads = 3;
+    const bool exact = decodeFile(bytes, options) == pcm && decodeBytes(bytes) == pcm;
+    return check(exact, "parallel decode", exact ? "3 threads, exact\n" : "3 threads, decoded samples differ\n");
+}
+
+// Stereo frames go through every decorrelation mode: four segments of a few frames each, built so that each mode
+// is the cheapest for one of them, coded with the estimated choice and with every pairing tried (low latency)
+bool checkStereoModes() {
+    const size_t frame = channelFrameSize(CodecOptions());
+    const size_t count = frame * 2 * 12;
+    const std::vector<unsigned char> pcm = makePcm(16, count, [&](size_t i) {
+        const size_t t = i / 2;
+        const double smooth = 6000 * std::sin(t * 0.005), rough = 3000 * noise(t);
+        const bool left = i % 2 == 0;
+        switch (t / (frame * 3)) {
+            case 0:  // Independent
+                return left ? smooth : 3000 * noise(i + count);
+            case 1:  // Left/side: the right channel is the left one roughened
+                return left ? smooth : smooth + rough;
+            case 2:  // Right/side
+                return left ? smooth + rough : smooth;
+            default:  // Mid/side: a shared smooth signal plus and minus a rough one
+                return left ? smooth + rough / 8 : smooth - rough / 8;
+        }
+    });
+    bool passed = true;
+    for (bool lowLatency : {false, true}) {
+        CodecOptions options;
+        options.low_latency = lowLatency;
+        options.latency_threads = 2;
+        EncoderStats stats;
+        const std::string name = lowLatency ? "stereo modes, every pairing" : "stereo modes";
+        passed &= checkRoundTrip(name, pcm, 2, 16, options, &stats);
+        bool used[4] = {};
+        for (const ChannelStats &channel : stats.channels) used[channel.stereo_mode] = true;
+        const char *modes[4] = {"independent", "left/side", "right/side", "mid/side"};
+        std::string line;
+        for (int mode = STEREO_INDEPENDENT; mode <= STEREO_MID_SIDE; mode++) {
+            line += std::string(mode ? ", " : "") + modes[mode] + (used[mode] ? " used" : " unused");
+        }
+        passed &= check(std::count(used, used + 4, true) == 4, name + " coverage", line + "\n");
+    }
+    return passed;
+}
+
+// Frame sizes chosen per region: quiet passages with bursts in between split the windows into frames of several
+// sizes, and the input ends in a partial window whose frame takes an explicit size
+bool checkBlockSizes() {
+    CodecOptions options;
+    options.block_effort = 3;
+    const size_t count = (size_t)channelFrameSize(options) * 2 * 3 + 1234 * 2;
+    const std::vector<unsigned char> pcm = makePcm(16, count, [](size_t i) {
+        const size_t t = i / 2;
+        const double burst = t % 5000 < 700 ? 12000 * noise(i) : 0;
+        return 300 * std::sin(t * 0.003 + i % 2) + burst;
+    });
+    EncoderStats stats;
+    bool passed = checkRoundTrip("block sizes", pcm, 2, 16, options, &stats);
+    std::vector<int> sizes;
+    for (const ChannelStats &channel : stats.channels) sizes.push_back(channel.samples);
+    std::sort(sizes.begin(), sizes.end());
+    sizes.erase(std::unique(sizes.begin(), sizes.end()), sizes.end());
+    std::string line;
+    for (int size : sizes) line += (line.empty() ? "" : ", ") + std::to_string(size);
+    return passed & check(sizes.size() >= 3, "block sizes coverage", "frames of " + line + " samples\n");
+}
+
+// Channels prediction cannot help: a constant one (the silent frames of the other channel too) and full-scale
+// noise, which prediction would expand and is stored verbatim
+bool checkConstantAndVerbatim() {
+    const size_t frame = channelFrameSize(CodecOptions());
+    const std::vector<unsigned char> pcm = makePcm(16, frame * 2 * 4, [&](size_t i) {
+        if (i % 2 == 0) return -777.0;
+        return i / 2 < frame * 2 ? 32767 * noise(i) : 0.0;
+    });
+    EncoderStats stats;
+    bool passed = checkRoundTrip("constant and verbatim", pcm, 2, 16, CodecOptions(), &stats);
+    int constant = 0, verbatim = 0;
+    for (const ChannelStats &channel : stats.channels) {
+        constant += std::string(channel.predictor) == PREDICTOR_NAMES[PREDICTOR_CONSTANT];
+        verbatim += std::string(channel.predictor) == PREDICTOR_NAMES[PREDICTOR_VERBATIM];
+    }
+    return passed & check(constant > 0 && verbatim > 0, "constant and verbatim coverage",
+                          std::to_string(constant) + " constant and " + std::to_string(verbatim) +
+                              " verbatim channels\n");
+}
+
+// Samples padded with zero low bits, as 12-bit material in a 16-bit container, then with more of them and with
+// none, so the wasted shift changes from frame to frame
+bool checkWastedBits() {
+    const size_t frame = channelFrameSize(CodecOptions());
+    const std::vector<unsigned char> pcm = makePcm(16, frame * 2 * 6, [&](size_t i) {
+        const int shift = i / (frame * 4) == 0 ? 4 : i / (frame * 4) == 1 ? 9 : 0;
+        const double sample = 20000 * std::sin(i / 2 * 0.02 + i % 2) + 500 * noise(i);
+        return std::ldexp(std::floor(std::ldexp(sample, -shift)), shift);
+    });
+    EncoderStats stats;
+    bool passed = checkRoundTrip("wasted bits", pcm, 2, 16, CodecOptions(), &stats);
+    int shifts[16] = {};
+    for (const ChannelStats &channel : stats.channels) shifts[channel.shift]++;
+    return passed & check(shifts[4] > 0 && shifts[9] > 0 && shifts[0] > 0, "wasted bits coverage",
+                          "channels shifted by 4: " + std::to_string(shifts[4]) + ", by 9: " +
+                              std::to_string(shifts[9]) + ", unshifted: " + std::to_string(shifts[0]) + "\n");
+}
+
+// Channels no longer than their predictor's warm-up, or barely longer, under every fixed Taylor degree and the
+// search (LPC orders up to 32), with and without the adaptive cascade
+bool checkWarmup() {
+    std::string failures;
+    int trips = 0;
+    for (size_t length : {1, 2, 3, 5, 8, 9, 33, 40}) {
+        const std::vector<unsigned char> pcm = makePcm(16, length * 2, [](size_t i) {
+            return 9000 * std::sin(i / 2 * 0.3 + i % 2) + 40 * noise(i);
+        });
+        for (int degree = -1; degree <= MAX_TAYLOR_DEGREE; degree++) {
+            if (degree == 0) continue;
+            for (bool high : {false, true}) {
+                CodecOptions options;
+                options.high_compression = high;
+                trips++;
+                if (decodeBytes(encodeBytes(pcm, 2, 16, options, nullptr, degree)) != pcm) {
+                    const std::string predictor = degree < 0 ? "search" : "taylor" + std::to_string(degree);
+                    failures += " " + std::to_string(length) + "/" + predictor + (high ? "/high" : "");
+                }
+            }
+        }
+    }
+    return check(failures.empty(), "warm-up",
+                 failures.empty() ? std::to_string(trips) + " short channels exact\n" : "differ:" + failures + "\n");
+}
+
+// Every sample format, each over its whole range: 8 and 24-bit through the predictors directly, 32-bit integer
+// and float through the core samples and extension of wide.h (24-bit material in a 32-bit container, float zeros,
+// denormals, infinities and NaNs among them)
+bool checkSampleFormats() {
+    const size_t count = (size_t)channelFrameSize(CodecOptions()) * 2 * 3;
+    auto music = [](size_t i) { return std::sin(i / 2 * 0.01 + i % 2) * 0.8 + 0.05 * noise(i); };
+    auto extremes = [](size_t i, double limit) { return i % 97 == 0 ? -limit - 1 : i % 89 == 0 ? limit : 0.0; };
+    bool passed = true;
+    for (int format : {8, 24, 32}) {
+        const double limit = std::ldexp(1.0, format - 1) - 1;
+        passed &= checkRoundTrip(std::to_string(format) + "-bit", makePcm(format, count, [&](size_t i) {
+            return i < count / 2 ? std::round(music(i) * limit) : extremes(i, limit) + std::round(music(i) * 100);
+        }), 2, format);
+    }
+    passed &= checkRoundTrip("24-bit in 32-bit", makePcm(32, count, [&](size_t i) {
+        return std::round(music(i) * 8388607) * 256;
+    }), 2, 32);
+    passed &= checkRoundTrip("float from 24-bit", makePcm(PCM_FLOAT, count, [&](size_t i) {
+        return std::round(music(i) * 8388607) / 8388608;
+    }), 2, PCM_FLOAT);
+    const double special[] = {0.0, -0.0, 1e-40, -1e-42, 1e-30, INFINITY, -INFINITY, NAN, 1.0, -1.0, 3e38};
+    passed &= checkRoundTrip("float", makePcm(PCM_FLOAT, count, [&](size_t i) {
+        return i % 50 == 7 ? special[i / 50 % 11] : music(i) * (i < count / 2 ? 1 : 1e-3) + 1e-7 * noise(i + count);
+    }), 2, PCM_FLOAT);
+    return passed;
+}
+
+// Hybrid coding: a lossy stream decodes on its own with quantization noise, and with its correction stream
+// back to the source exactly, for every format hybrid coding takes
+bool checkHybrid() {
+    bool passed = true;
+    for (int format : {8, 16, 24}) {
+        const double limit = std::ldexp(1.0, format - 1) - 1;
+        const std::vector<unsigned char> pcm =
+            makePcm(format, (size_t)channelFrameSize(CodecOptions()) * 2 * 8, [&](size_t i) {
+                return std::round((std::sin(i / 2 * 0.02 + i % 2) * 0.6 + 0.3 * noise(i)) * limit);
+            });
+        const size_t count = pcm.size() / pcmBytes(format);
+        AudioEncoder encoder(2, 44100, format, true, 200, -1, CodecOptions(), count);
+        encoder.enableCorrection();
+        encoder.pushSamples(PcmSpan(pcm.data(), count, pcmBytes(format)));
+        encoder.finish();
+        const std::string bytes = encoder.pullBytes(), correction = encoder.pullCorrectionBytes();
+        const std::vector<unsigned char> lossy = decodeBytes(bytes);
+        const bool exact = decodeFile(bytes, CodecOptions(), correction) == pcm;
+        passed &= check(lossy.size() == pcm.size() && lossy != pcm && exact, std::to_string(format) + "-bit hybrid",
+                        std::to_string(bytes.size()) + " + " + std::to_string(correction.size()) + " bytes, lossy " +
+                            (lossy.size() == pcm.size() && lossy != pcm ? "quantized" : "not quantized") +
+                            (exact ? ", corrected exactly\n" : ", corrected samples differ\n"));
+    }
+    return passed;
+}
+
+int main() {
+    const unsigned int channels = 2;
+    std::vector<int16_t> silence(channels * 5000, 0);
+    AudioEncoder encoder(channels, 44100, 16, false, 0, -1, CodecOptions(), silence.size());
+    encoder.pushSamples(Span<const int16_t>(silence.data(), silence.size()));
+    encoder.finish();
+    const std::string stream = encoder.pullBytes();
+
+    // The first frame follows the 12-byte header and its length prefix, its block size code is the top 3 bits
+    const size_t blockCode = 12 + FRAME_LENGTH_BITS / 8;
+    bool passed = true;
+    std::string line;
+    passed &= check(verifyBytes(stream, line) == 0 && line.find("OK") != std::string::npos, "intact", line);
+    for (int code : {5, 6}) {
+        std::string damaged = stream;
+        damaged[blockCode] = (char)((damaged[blockCode] & 0x1F) | code << 5);
+        const int status = verifyBytes(damaged, line);
+        passed &= check(status != 0 && line.find("CORRUPT") != std::string::npos,
+                        "block code " + std::to_string(code), line);
+    }
+
+    // A sine coded with Taylor degree 1 in one full frame, whose first Rice parameter follows the frame header
+    // (no wasted bits), the channel header, the two warm-up samples and the partition order
+    const int frameSize = channelFrameSize(CodecOptions());
+    std::vector<int16_t> sine(frameSize);
+    for (int i = 0; i < frameSize; i++) sine[i] = (int16_t)std::lround(1000 * std::sin(i / 20.0));
+    AudioEncoder sineEncoder(1, 44100, 16, false, 0, 1, CodecOptions(), sine.size());
+    sineEncoder.pushSamples(Span<const int16_t>(sine.data(), sine.size()));
+    sineEncoder.finish();
+    const std::string sineStream = sineEncoder.pullBytes();
+    const int32_t warmup[2] = {sine[0], sine[1]};
+    const uint64_t parameterBit = (12 + FRAME_LENGTH_BITS / 8) * 8 + BLOCK_CODE_BITS + 4 + 1 + PREDICTOR_TYPE_BITS + 3 +
+                                  warmupBits(Span<const int32_t>(warmup, 2)) + RICE_ORDER_BITS;
+    passed &= check(verifyBytes(sineStream, line) == 0 && line.find("OK") != std::string::npos, "intact sine", line);
+    for (int parameter : {RICE_MAX_PARAMETER + 1, (1 << RICE_PARAMETER_BITS) - 1}) {
+        std::string damaged = sineStream;
+        for (int i = 0; i < RICE_PARAMETER_BITS; i++) {
+            const uint64_t bit = parameterBit + i;
+            const char mask = (char)(0x80 >> bit % 8);
+            const bool set = parameter >> (RICE_PARAMETER_BITS - 1 - i) & 1;
+            damaged[bit / 8] = set ? damaged[bit / 8] | mask : damaged[bit / 8] & ~mask;
+        }
+        const int status = verifyBytes(damaged, line);
+        passed &= check(status != 0 && line.find("Invalid Rice parameter") != std::string::npos,
+                        "Rice parameter " + std::to_string(parameter), line);
+    }
+
+    // Library callers skip the command line checks, the encoder itself rejects degrees it has no predictor for
+    bool rejected = false;
+    try {
+        AudioEncoder(channels, 44100, 16, false, 0, MAX_TAYLOR_DEGREE + 1);
+    } catch (const std::invalid_argument &e) {
+        rejected = true;
+        line = std::string(e.what()) + "\n";
+    }
+    passed &= check(rejected, "predictor degree " + std::to_string(MAX_TAYLOR_DEGREE + 1), rejected ? line : "");
+
+    passed &= checkParallelDecode();
+    passed &= checkStereoModes();
+    passed &= checkBlockSizes();
+    passed &= checkConstantAndVerbatim();
+    passed &= checkWastedBits();
+    passed &= checkWarmup();
+    passed &= checkSampleFormats();
+    passed &= checkHybrid();
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,362 @@
+#ifndef WAV_IO
+#define WAV_IO
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Non-owning view over a contiguous run of elements
+template <typename T>
+class Span {
+   private:
+    T *ptr;
+    size_t count;
+
+   public:
+    Span() : ptr(nullptr), count(0) {}
+    Span(T *ptr, size_t count) : ptr(ptr), count(count) {}
+
+    T *data() const { return ptr; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    T &operator[](size_t i) const { return ptr[i]; }
+    T *begin() const { return ptr; }
+    T *end() const { return ptr + count; }
+    Span subspan(size_t offset, size_t length) const { return Span(ptr + offset, length); }
+};
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+   private:
+    const unsigned char *mapped = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+   public:
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const std::string &filename) {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size)) return false;
+        length = static_cast<size_t>(size.QuadPart);
+        if (length == 0) return true;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) return false;
+        mapped = static_cast<const unsigned char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        return mapped != nullptr;
+#else
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            ::close(fd);
+            return false;
+        }
+        length = static_cast<size_t>(info.st_size);
+        if (length > 0) {
+            void *address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address != MAP_FAILED) {
+                mapped = static_cast<const unsigned char *>(address);
+                madvise(address, length, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd);  // The mapping stays valid after the descriptor is closed
+        return length == 0 || mapped != nullptr;
+#endif
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (mapped) UnmapViewOfFile(mapped);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (mapped) munmap(const_cast<unsigned char *>(mapped), length);
+#endif
+        mapped = nullptr;
+        length = 0;
+    }
+
+    const unsigned char *data() const { return mapped; }
+    size_t size() const { return length; }
+};
+
+// Little-endian helpers for the RIFF fields
+inline uint16_t readLE16(const unsigned char *p) { return p[0] | (p[1] << 8); }
+inline uint32_t readLE32(const unsigned char *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+// Integer PCM containers, little-endian as in WAV files: 8-bit samples are unsigned, wider ones two's complement.
+// The codec is instantiated for each one, so loading and storing compile down to the right shifts for the width.
+template <int Bits>
+struct PcmFormat;
+
+template <>
+struct PcmFormat<8> {
+    static constexpr int BITS = 8;
+    static int32_t load(const unsigned char *p) { return (int32_t)p[0] - 128; }
+    static void store(unsigned char *p, int32_t sample) { p[0] = (unsigned char)(sample + 128); }
+};
+
+template <>
+struct PcmFormat<16> {
+    static constexpr int BITS = 16;
+    static int32_t load(const unsigned char *p) { return (int16_t)(p[0] | (p[1] << 8)); }
+    static void store(unsigned char *p, int32_t sample) {
+        p[0] = (unsigned char)sample;
+        p[1] = (unsigned char)(sample >> 8);
+    }
+};
+
+template <>
+struct PcmFormat<24> {
+    static constexpr int BITS = 24;
+    static int32_t load(const unsigned char *p) {
+        return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) >> 8;  // Sign extend
+    }
+    static void store(unsigned char *p, int32_t sample) {
+        p[0] = (unsigned char)sample;
+        p[1] = (unsigned char)(sample >> 8);
+        p[2] = (unsigned char)(sample >> 16);
+    }
+};
+
+template <>
+struct PcmFormat<32> {
+    static constexpr int BITS = 32;
+    static int32_t load(const unsigned char *p) {
+        return (int32_t)((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+    }
+    static void store(unsigned char *p, int32_t sample) {
+        p[0] = (unsigned char)sample;
+        p[1] = (unsigned char)(sample >> 8);
+        p[2] = (unsigned char)(sample >> 16);
+        p[3] = (unsigned char)(sample >> 24);
+    }
+};
+
+// Sample formats are named by their bit depth, 32-bit IEEE float PCM by PCM_FLOAT. Float samples travel as the
+// bits of their 32-bit container (PcmFormat<32>), see wide.h for how they are coded.
+const int PCM_FLOAT = 33;
+
+inline bool isSupportedBitDepth(int bits) {
+    return bits == 8 || bits == 16 || bits == 24 || bits == 32 || bits == PCM_FLOAT;
+}
+inline int pcmBytes(int format) { return format == PCM_FLOAT ? 4 : format / 8; }
+inline std::string pcmFormatName(int format) {
+    return format == PCM_FLOAT ? "32-bit float" : std::to_string(format) + "-bit";
+}
+
+// Value of a sample of any supported format, for measurements
+inline double pcmValue(const unsigned char *p, int format) {
+    switch (format) {
+        case 8:
+            return PcmFormat<8>::load(p);
+        case 24:
+            return PcmFormat<24>::load(p);
+        case 32:
+            return PcmFormat<32>::load(p);
+        case PCM_FLOAT: {
+            const uint32_t bits = PcmFormat<32>::load(p);
+            float value;
+            std::memcpy(&value, &bits, sizeof value);
+            return value;
+        }
+        default:
+            return PcmFormat<16>::load(p);
+    }
+}
+
+// Call body(PcmFormat<bits>()) for 8, 16 and 24 bits, the widths the predictors code directly (see wide.h)
+template <typename Body>
+void withPcmFormat(int bits, Body &&body) {
+    switch (bits) {
+        case 8:
+            body(PcmFormat<8>());
+            break;
+        case 24:
+            body(PcmFormat<24>());
+            break;
+        default:
+            body(PcmFormat<16>());
+            break;
+    }
+}
+
+// Interleaved PCM samples left in their container, bytesPerSample bytes each
+class PcmSpan {
+   private:
+    const unsigned char *bytes = nullptr;
+    size_t count = 0;
+    int width = 2;
+
+   public:
+    PcmSpan() = default;
+    PcmSpan(const unsigned char *bytes, size_t count, int bytesPerSample)
+        : bytes(bytes), count(count), width(bytesPerSample) {}
+
+    const unsigned char *data() const { return bytes; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    int bytesPerSample() const { return width; }
+    PcmSpan subspan(size_t offset, size_t length) const { return PcmSpan(bytes + offset * width, length, width); }
+};
+
+// RIFF/WAVE parser for 8, 16, 24 and 32-bit integer PCM and 32-bit float PCM. The file is memory mapped and the
+// interleaved samples are read in place.
+class WavReader {
+   private:
+    MappedFile file;
+    PcmSpan sampleData;
+    unsigned int channelCount = 0;
+    unsigned int sampleRate = 0;
+    int bitsPerSample = 16;
+    std::string error;
+
+    bool fail(const std::string &message) {
+        error = message;
+        file.close();
+        return false;
+    }
+
+   public:
+    bool open(const std::string &filename) {
+        if (!file.open(filename)) return fail("cannot open file");
+        const unsigned char *data = file.data();
+        const size_t size = file.size();
+        if (size < 12 || std::memcmp(data, "RIFF", 4) != 0 || std::memcmp(data + 8, "WAVE", 4) != 0)
+            return fail("not a RIFF/WAVE file");
+
+        bool haveFormat = false;
+        size_t pos = 12;
+        while (pos + 8 <= size) {
+            const unsigned char *chunk = data + pos;
+            size_t chunkSize = readLE32(chunk + 4);
+            pos += 8;
+
+            if (std::memcmp(chunk, "fmt ", 4) == 0) {
+                if (chunkSize < 16 || pos + chunkSize > size) return fail("truncated fmt chunk");
+                uint16_t format = readLE16(chunk + 8);
+                bitsPerSample = readLE16(chunk + 22);
+                // WAVE_FORMAT_EXTENSIBLE keeps the real format in the first two bytes of the sub-format GUID
+                if (format == 0xFFFE && chunkSize >= 40) format = readLE16(chunk + 32);
+                if (format == 3 && bitsPerSample == 32) bitsPerSample = PCM_FLOAT;
+                if ((format != 1 && format != 3) || (format == 3) != (bitsPerSample == PCM_FLOAT) ||
+                    !isSupportedBitDepth(bitsPerSample))
+                    return fail("only 8, 16, 24 and 32-bit integer and 32-bit float PCM are supported");
+                channelCount = readLE16(chunk + 10);
+                sampleRate = readLE32(chunk + 12);
+                haveFormat = channelCount > 0;
+            } else if (std::memcmp(chunk, "data", 4) == 0) {
+                if (!haveFormat) return fail("data chunk before fmt chunk");
+                // Streamed WAVs may carry a placeholder size, trust the file length instead
+                chunkSize = std::min(chunkSize, size - pos);
+                const int bytesPerSample = pcmBytes(bitsPerSample);
+                sampleData = PcmSpan(data + pos, chunkSize / bytesPerSample, bytesPerSample);
+                return true;
+            }
+            pos += chunkSize + (chunkSize & 1);  // Chunks are padded to an even size
+        }
+        return fail("no data chunk");
+    }
+
+    PcmSpan samples() const { return sampleData; }
+    unsigned int getChannelCount() const { return channelCount; }
+    unsigned int getSampleRate() const { return sampleRate; }
+    int getBitsPerSample() const { return bitsPerSample; }
+    uint64_t getSampleCount() const { return sampleData.size(); }
+    const std::string &getError() const { return error; }
+};
+
+// Writes PCM WAV files straight from the caller's sample buffers, the RIFF sizes are filled in on close
+class WavWriter {
+   private:
+    std::ofstream file;
+    unsigned int channelCount = 0;
+    unsigned int sampleRate = 0;
+    int bitsPerSample = 16;
+    uint64_t dataBytes = 0;
+
+    void writeLE16(uint16_t value) {
+        unsigned char bytes[2] = {(unsigned char)value, (unsigned char)(value >> 8)};
+        file.write(reinterpret_cast<char *>(bytes), 2);
+    }
+
+    void writeLE32(uint32_t value) {
+        unsigned char bytes[4] = {(unsigned char)value, (unsigned char)(value >> 8), (unsigned char)(value >> 16),
+                                  (unsigned char)(value >> 24)};
+        file.write(reinterpret_cast<char *>(bytes), 4);
+    }
+
+    void writeHeader() {
+        uint32_t dataSize = dataBytes > 0xFFFFFFFF - 36 ? 0xFFFFFFFF - 36 : (uint32_t)dataBytes;
+        file.write("RIFF", 4);
+        writeLE32(36 + dataSize);
+        file.write("WAVEfmt ", 8);
+        writeLE32(16);                                  // fmt chunk size
+        writeLE16(bitsPerSample == PCM_FLOAT ? 3 : 1);  // IEEE float or integer PCM
+        writeLE16(channelCount);
+        writeLE32(sampleRate);
+        writeLE32(sampleRate * channelCount * pcmBytes(bitsPerSample));  // Byte rate
+        writeLE16(channelCount * pcmBytes(bitsPerSample));               // Block align
+        writeLE16(8 * pcmBytes(bitsPerSample));
+        file.write("data", 4);
+        writeLE32(dataSize);
+    }
+
+   public:
+    ~WavWriter() { close(); }
+
+    bool open(const std::string &filename, unsigned int rate, unsigned int channels, int bits) {
+        file.open(filename, std::ios::out | std::ios::binary);
+        if (!file.is_open()) return false;
+        sampleRate = rate;
+        channelCount = channels;
+        bitsPerSample = bits;
+        dataBytes = 0;
+        writeHeader();  // Placeholder sizes until close()
+        return true;
+    }
+
+    // Write samples already in their little-endian container
+    void write(const unsigned char *bytes, size_t size) {
+        file.write(reinterpret_cast<const char *>(bytes), size);
+        dataBytes += size;
+    }
+
+    void close() {
+        if (!file.is_open()) return;
+        file.seekp(0);
+        writeHeader();
+        file.close();
+    }
+};
+
+#endif
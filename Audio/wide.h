@@ -0,0 +1,205 @@
+#ifndef WIDE
+#define WIDE
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+#include "../Common/bitStream.h"
+#include "./audio_utilities.h"
+
+// 32-bit integer and float PCM are coded as 24-bit core samples, which go through the predictors like any 24-bit
+// input, and an extension after the frame's channels holding what the core samples leave out.
+//   Integer: samples wider than 24 bits keep their top 24 bits in the core and the lowBits below in the extension.
+//   Float: samples become fixed-point values scaled to the frame's loudest normal sample (maxExponent), the core
+//   keeps their top 23 significant bits with the sign and the extension the mantissa bits below. Zeros, denormals,
+//   infinities, NaNs and samples too quiet for the scale are exceptions kept bit for bit (core value 0), +0.0 is
+//   simply a core 0.
+// The extension's low bits come behind a flag, cleared when they are all zero (24-bit material in a 32-bit container
+// or float converted from integers) and by lossy encoders, which code the core samples alone.
+const int WIDE_CORE_BITS = 24;
+const int WIDE_LOW_BITS = 4;       // Integer low bits field, 0 to 8
+const int FLOAT_EXPONENT_BITS = 8;
+const int FLOAT_MANTISSA_BITS = 23;
+
+inline bool isWidePcm(int format) { return format == 32 || format == PCM_FLOAT; }
+
+// Width of the samples the predictors see for a PCM format
+inline int codedSampleBits(int format) { return isWidePcm(format) ? WIDE_CORE_BITS : format; }
+
+// A frame of wide samples split into core samples and extension
+struct WideFrame {
+    std::vector<unsigned char> narrow;  // Core samples as interleaved 24-bit PCM
+    int lowBits = 0;                    // Integer
+    int maxExponent = 1;                // Float
+    std::vector<uint32_t> low;          // Bits below each core sample
+    std::vector<uint8_t> lowWidth;      // and their count
+    std::vector<int32_t> exceptions;    // Float samples kept as they are, by index
+    std::vector<uint32_t> exceptionValues;
+
+    PcmSpan core() const { return PcmSpan(narrow.data(), narrow.size() / 3, 3); }
+    bool hasLow() const {
+        return std::any_of(low.begin(), low.end(), [](uint32_t bits) { return bits != 0; });
+    }
+};
+
+// Split a frame of 32-bit integer or float PCM (format) into wide
+void splitWideFrame(PcmSpan frame, int format, WideFrame &wide) {
+    const size_t n = frame.size();
+    wide.narrow.resize(n * 3);
+    wide.low.assign(n, 0);
+    wide.lowWidth.assign(n, 0);
+    wide.exceptions.clear();
+    wide.exceptionValues.clear();
+    if (format == 32) {
+        int64_t minimum = 0, maximum = 0;
+        for (size_t i = 0; i < n; i++) {
+            const int64_t sample = PcmFormat<32>::load(frame.data() + i * 4);
+            minimum = std::min(minimum, sample);
+            maximum = std::max(maximum, sample);
+        }
+        int width = WIDE_CORE_BITS;
+        while (minimum < -(INT64_C(1) << (width - 1)) || maximum >= (INT64_C(1) << (width - 1))) width++;
+        wide.lowBits = width - WIDE_CORE_BITS;
+        for (size_t i = 0; i < n; i++) {
+            const int32_t sample = PcmFormat<32>::load(frame.data() + i * 4);
+            PcmFormat<24>::store(&wide.narrow[i * 3], sample >> wide.lowBits);
+            wide.low[i] = (uint32_t)sample & ((1u << wide.lowBits) - 1);
+            wide.lowWidth[i] = wide.lowBits;
+        }
+        return;
+    }
+
+    wide.maxExponent = 1;
+    for (size_t i = 0; i < n; i++) {
+        const int exponent = PcmFormat<32>::load(frame.data() + i * 4) >> FLOAT_MANTISSA_BITS & 0xFF;
+        if (exponent < 0xFF) wide.maxExponent = std::max(wide.maxExponent, exponent);
+    }
+    for (size_t i = 0; i < n; i++) {
+        const uint32_t bits = PcmFormat<32>::load(frame.data() + i * 4);
+        const int exponent = bits >> FLOAT_MANTISSA_BITS & 0xFF;
+        const int shift = wide.maxExponent - exponent + 1;  // Bits of the mantissa below the core sample
+        int32_t sample = 0;
+        if (exponent == 0 || exponent == 0xFF || shift >= WIDE_CORE_BITS) {
+            if (bits != 0) {
+                wide.exceptions.push_back(i);
+                wide.exceptionValues.push_back(bits);
+            }
+        } else {
+            const uint32_t mantissa = (bits & ((1u << FLOAT_MANTISSA_BITS) - 1)) | 1u << FLOAT_MANTISSA_BITS;
+            sample = mantissa >> shift;
+            if (bits >> 31) sample = -sample;
+            wide.low[i] = mantissa & ((1u << shift) - 1);
+            wide.lowWidth[i] = shift;
+        }
+        PcmFormat<24>::store(&wide.narrow[i * 3], sample);
+    }
+}
+
+// Gaps between successive exception indices
+inline std::vector<int32_t> exceptionGaps(const std::vector<int32_t> &exceptions) {
+    std::vector<int32_t> gaps(exceptions.size());
+    for (size_t i = 0; i < gaps.size(); i++) gaps[i] = exceptions[i] - (i ? exceptions[i - 1] + 1 : 0);
+    return gaps;
+}
+
+// Size of the extension written by writeWideExtension
+uint64_t wideExtensionBits(const WideFrame &wide, int format, bool keepLow) {
+    uint64_t bits = 1;
+    if (format == 32) {
+        bits += WIDE_LOW_BITS;
+    } else {
+        const int32_t count = wide.exceptions.size();
+        bits += FLOAT_EXPONENT_BITS + storedSampleBits(Span<const int32_t>(&count, 1));
+        if (count > 0) {
+            const std::vector<int32_t> gaps = exceptionGaps(wide.exceptions);
+            bits += storedSampleBits(Span<const int32_t>(gaps.data(), gaps.size())) + 32 * (uint64_t)count;
+        }
+    }
+    if (keepLow && wide.hasLow()) {
+        for (uint8_t width : wide.lowWidth) bits += width;
+    }
+    return bits;
+}
+
+// Write the extension of a frame after its channels, keepLow is false for lossy streams
+void writeWideExtension(BitStream &stream, const WideFrame &wide, int format, bool keepLow) {
+    if (format == 32) {
+        stream.writeBits(wide.lowBits, WIDE_LOW_BITS);
+    } else {
+        const int32_t count = wide.exceptions.size();
+        stream.writeBits(wide.maxExponent, FLOAT_EXPONENT_BITS);
+        writeStoredSamples(stream, Span<const int32_t>(&count, 1));
+        if (count > 0) {
+            const std::vector<int32_t> gaps = exceptionGaps(wide.exceptions);
+            writeStoredSamples(stream, Span<const int32_t>(gaps.data(), gaps.size()));
+            for (uint32_t value : wide.exceptionValues) stream.writeBits(value, 32);
+        }
+    }
+    const bool withLow = keepLow && wide.hasLow();
+    stream.writeBit(withLow);
+    if (withLow) {
+        for (size_t i = 0; i < wide.low.size(); i++) {
+            if (wide.lowWidth[i]) stream.writeBits(wide.low[i], wide.lowWidth[i]);
+        }
+    }
+}
+
+// Rebuild a frame of format PCM from its decoded core samples and the extension read from stream. Damaged
+// extensions throw std::runtime_error.
+void joinWideFrame(BitStream &stream, int format, PcmSpan core, unsigned char *output) {
+    const size_t n = core.size();
+    if (format == 32) {
+        const int lowBits = stream.readBits(WIDE_LOW_BITS);
+        if (lowBits > 32 - WIDE_CORE_BITS) throw std::runtime_error("Invalid wide sample extension");
+        const bool withLow = stream.readBit();
+        for (size_t i = 0; i < n; i++) {
+            const uint32_t low = withLow && lowBits ? stream.readBits(lowBits) : 0;
+            const uint32_t sample = (uint32_t)PcmFormat<24>::load(core.data() + i * 3) << lowBits | low;
+            PcmFormat<32>::store(output + i * 4, sample);
+        }
+        return;
+    }
+
+    const int maxExponent = stream.readBits(FLOAT_EXPONENT_BITS);
+    int32_t count;
+    readStoredSamples(stream, &count, 1);
+    if (count < 0 || (size_t)count > n) throw std::runtime_error("Invalid wide sample extension");
+    std::vector<int32_t> exceptions(count);
+    std::vector<uint32_t> exceptionValues(count);
+    if (count > 0) {
+        readStoredSamples(stream, exceptions.data(), count);
+        for (int32_t i = 0, next = 0; i < count; i++) {
+            if (exceptions[i] < 0 || exceptions[i] >= (int64_t)n - next) {
+                throw std::runtime_error("Invalid wide sample extension");
+            }
+            exceptions[i] += next;
+            next = exceptions[i] + 1;
+        }
+        for (uint32_t &value : exceptionValues) value = stream.readBits(32);
+    }
+    const bool withLow = stream.readBit();
+    size_t nextException = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t bits = 0;
+        const int32_t sample = PcmFormat<24>::load(core.data() + i * 3);
+        if (nextException < exceptions.size() && (size_t)exceptions[nextException] == i) {
+            bits = exceptionValues[nextException++];
+        } else if (sample != 0) {
+            // Lossy reconstructions may reach the 24-bit limit, which a lossless core sample never does
+            const uint32_t magnitude = std::min<uint32_t>(std::abs(sample), (1u << FLOAT_MANTISSA_BITS) - 1);
+            const int shift = __builtin_clz(magnitude) - (32 - WIDE_CORE_BITS);
+            const uint32_t mantissa = magnitude << shift | (withLow ? (uint32_t)stream.readBits(shift) : 0);
+            const int exponent = maxExponent - shift + 1;
+            bits = (uint32_t)(sample < 0) << 31;
+            if (exponent >= 1) {  // Lossy streams may scale below the normal range, leaving a signed zero
+                bits |= (uint32_t)exponent << FLOAT_MANTISSA_BITS | (mantissa & ((1u << FLOAT_MANTISSA_BITS) - 1));
+            }
+        }
+        PcmFormat<32>::store(output + i * 4, bits);
+    }
+}
+
+#endif
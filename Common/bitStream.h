@@ -11,6 +11,8 @@
 class BitStream {
 private:
     std::fstream file;
+    std::istream* in;     // Stream bits are read from (the file or a caller-owned stream)
+    std::ostream* out;    // Stream bits are written to (the file or a caller-owned stream)
     unsigned char buffer;  // 8-bit buffer for reading/writing
     int bufferPos;        // Current position in buffer (0-7)
     bool isWriteMode;     // Track if we're in write mode
@@ -18,9 +20,8 @@ private:
     // Helper method to flush buffer to file
     void flushBuffer() {
         if (isWriteMode && bufferPos > 0) {
-            // Pad the remaining bits with zeros
-            buffer <<= (8 - bufferPos);
-            file.write(reinterpret_cast<char*>(&buffer), 1);
+            // Bits are already stored from the MSB down, the remaining ones are zero padding
+            out->write(reinterpret_cast<char*>(&buffer), 1);
             buffer = 0;
             bufferPos = 0;
         }
@@ -28,11 +29,13 @@ private:
 
 public:
     BitStream(const std::string& filename, bool write = true) :
-        buffer(0), bufferPos(0), isWriteMode(write) {
+        in(nullptr), out(nullptr), buffer(0), bufferPos(0), isWriteMode(write) {
         if (write) {
             file.open(filename, std::ios::out | std::ios::binary);
+            out = &file;
         } else {
             file.open(filename, std::ios::in | std::ios::binary);
+            in = &file;
         }
 
         if (!file.is_open()) {
@@ -40,11 +43,22 @@ public:
         }
     }
 
+    // Write bits to an already open stream (memory buffer, stdout, ...)
+    explicit BitStream(std::ostream& stream) :
+        in(nullptr), out(&stream), buffer(0), bufferPos(0), isWriteMode(true) {}
+
+    // Read bits from an already open stream (memory buffer, stdin, ...)
+    explicit BitStream(std::istream& stream) :
+        in(&stream), out(nullptr), buffer(0), bufferPos(0), isWriteMode(false) {}
+
     ~BitStream() {
         if (isWriteMode) {
             flushBuffer();
+            out->flush();
+        }
+        if (file.is_open()) {
+            file.close();
         }
-        file.close();
     }
 
     // Write a single bit to the file
@@ -57,7 +71,7 @@ public:
         bufferPos++;
 
         if (bufferPos == 8) {
-            file.write(reinterpret_cast<char*>(&buffer), 1);
+            out->write(reinterpret_cast<char*>(&buffer), 1);
             buffer = 0;
             bufferPos = 0;
         }
@@ -68,7 +82,7 @@ public:
         if (bufferPos < 8) {  // Still bits left in the buffer
             return false;
         }
-        return file.eof();  // Check if end of file flag is set
+        return in->eof();  // Check if end of file flag is set
     }
 
     // Read a single bit from the file
@@ -79,8 +93,8 @@ public:
 
         if (bufferPos == 0 || bufferPos == 8) {
             char nextByte;
-            if (!file.read(&nextByte, 1)) {
-                if (file.eof()) {
+            if (!in->read(&nextByte, 1)) {
+                if (in->eof()) {
                     return false;  // Return false if end of file is reached
                 } else {
                     throw std::runtime_error("Error reading from file");
@@ -119,6 +133,52 @@ public:
         return result;
     }
 
+    // Pad the current byte with zeros (write mode) or drop its unread bits (read mode)
+    void alignToByte() {
+        if (isWriteMode) {
+            flushBuffer();
+        } else {
+            bufferPos = 0;
+        }
+    }
+
+    // Write raw bytes starting at the next byte boundary
+    void writeBytes(const char* data, size_t length) {
+        if (!isWriteMode) {
+            throw std::runtime_error("Stream not in write mode");
+        }
+        alignToByte();
+        out->write(data, length);
+    }
+
+    // Read raw bytes starting at the next byte boundary
+    void readBytes(char* data, size_t length) {
+        if (isWriteMode) {
+            throw std::runtime_error("Stream not in read mode");
+        }
+        alignToByte();
+        if (!in->read(data, length)) {
+            throw std::runtime_error("Error reading from file");
+        }
+    }
+
+    // Byte offset of the next byte boundary in the underlying stream
+    std::streampos tellByte() {
+        alignToByte();
+        return isWriteMode ? out->tellp() : in->tellg();
+    }
+
+    // Move to an absolute byte offset in the underlying stream
+    void seekByte(std::streampos position) {
+        alignToByte();
+        if (isWriteMode) {
+            out->seekp(position);
+        } else {
+            in->clear();
+            in->seekg(position);
+        }
+    }
+
     // Write a string as bits
     void writeString(const std::string& str) {
         for (char c : str) {
@@ -0,0 +1,83 @@
+#ifndef CRC32C
+#define CRC32C
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_HARDWARE
+#endif
+
+// CRC-32C (Castagnoli polynomial), computed incrementally. x86-64 CPUs with SSE4.2 run it through the crc32
+// instruction, eight bytes at a time; other machines use slicing-by-8 tables.
+class Crc32c {
+private:
+    uint32_t state = 0xFFFFFFFF;
+
+    static const uint32_t (&tables())[8][256] {
+        static uint32_t table[8][256];
+        static bool ready = [] {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0x82F63B78 & -(crc & 1));
+                table[0][i] = crc;
+            }
+            for (uint32_t i = 0; i < 256; i++) {
+                for (int t = 1; t < 8; t++) table[t][i] = (table[t - 1][i] >> 8) ^ table[0][table[t - 1][i] & 0xFF];
+            }
+            return true;
+        }();
+        (void)ready;
+        return table;
+    }
+
+    static uint32_t updateSoftware(uint32_t crc, const unsigned char* p, size_t n) {
+        const uint32_t (&table)[8][256] = tables();
+        for (; n >= 8; p += 8, n -= 8) {
+            const uint32_t low = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+            crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^ table[5][(low >> 16) & 0xFF] ^
+                  table[4][low >> 24] ^ table[3][p[4]] ^ table[2][p[5]] ^ table[1][p[6]] ^ table[0][p[7]];
+        }
+        for (; n > 0; p++, n--) crc = (crc >> 8) ^ table[0][(crc ^ *p) & 0xFF];
+        return crc;
+    }
+
+#ifdef CRC32C_HARDWARE
+    __attribute__((target("sse4.2"))) static uint32_t updateHardware(uint32_t crc, const unsigned char* p, size_t n) {
+        uint64_t crc64 = crc;
+        for (; n >= 8; p += 8, n -= 8) {
+            uint64_t word;
+            std::memcpy(&word, p, 8);
+            crc64 = _mm_crc32_u64(crc64, word);
+        }
+        crc = (uint32_t)crc64;
+        for (; n > 0; p++, n--) crc = _mm_crc32_u8(crc, *p);
+        return crc;
+    }
+
+    static bool hasHardware() {
+        static const bool supported = __builtin_cpu_supports("sse4.2");
+        return supported;
+    }
+#endif
+
+public:
+    // Add size bytes to the checksum
+    void update(const void* data, size_t size) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+#ifdef CRC32C_HARDWARE
+        if (hasHardware()) {
+            state = updateHardware(state, p, size);
+            return;
+        }
+#endif
+        state = updateSoftware(state, p, size);
+    }
+
+    // Checksum of every byte added so far
+    uint32_t value() const { return ~state; }
+};
+
+#endif